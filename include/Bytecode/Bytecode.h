@@ -56,7 +56,8 @@ enum Operation : char {
 
   /// Инициализирует массив. Предварительно нужно положить размер массива
   /// в операндовый стек. Затем кладёт указатель на вершину стека.
-  /// Например: PUSH 10; NEW ARRAY; // создаёт массив размером 10.
+  /// Операнды - место выделения в исходнике (функция и строка), используются профилировщиком кучи.
+  /// Например: PUSH 10; NEW ARRAY main 3; // создаёт массив размером 10.
   NEW_ARRAY = 12,
 
   /// Выводит в std::cout последнее значение из операндового стека.
@@ -86,6 +87,8 @@ enum Operation : char {
 
   /// Перемещает текущий указатель инструкции на заданный.
   /// Например: JUMP "condition"
+  /// Обратный переход развёрнутого цикла: JUMP "метка" "метка исходного цикла" "число итераций" "метка выхода",
+  /// в профиле считается за столько итераций исходного цикла без выхода из него.
   JUMP = 19,
 
   /// Сравнивает два числа из операндового стека, кладёт результат в флаги EQ, NE, LT, LE, GT, GE
@@ -93,6 +96,8 @@ enum Operation : char {
   CMP = 20,
 
   /// Прыгает на заданную метку если флаг EQ = true
+  /// Оптимизатор может добавить метку исходного перехода и "inverted", если обратил условие:
+  /// JUMP_EQ "метка" "исходная метка" "inverted". В профиле переход считается по исходной метке.
   JUMP_EQ = 21,
 
   /// Прыгает на заданную метку если флаг NE = true
@@ -108,7 +113,67 @@ enum Operation : char {
   JUMP_GT = 25,
 
   /// Прыгает на заданную метку если флаг GE = true
-  JUMP_GE = 26
+  JUMP_GE = 26,
+
+  /// То же, что и NEW_ARRAY, но массив размещается в локальной области стекфрейма
+  /// и освобождается целиком при RETURN. Ставится анализом убегания вместо NEW_ARRAY
+  /// для массивов, которые не покидают функцию.
+  /// Например: PUSH 10; NEW_LOCAL_ARRAY main 3;
+  NEW_LOCAL_ARRAY = 27,
+
+  /// То же, что и LOAD_FROM_INDEX, но без проверки границ массива.
+  /// Ставится оптимизатором, когда доказано, что индекс лежит в пределах массива.
+  /// Например: INTEGER_LOAD i; LOAD_FROM_INDEX_UNCHECKED "a"
+  LOAD_FROM_INDEX_UNCHECKED = 28,
+
+  /// То же, что и STORE_IN_INDEX, но без проверки границ массива.
+  /// Например: PUSH 1; INTEGER_LOAD i; STORE_IN_INDEX_UNCHECKED "a"
+  STORE_IN_INDEX_UNCHECKED = 29,
+
+  /// Берёт значение из стека операндов, сдвигает его влево на заданное число бит
+  /// и кладёт результат обратно. Ставится оптимизатором вместо умножения на степень двойки.
+  /// Например: INTEGER_LOAD i; SHIFT_LEFT 1; // i * 2
+  SHIFT_LEFT = 30,
+
+  /// Берёт значение из стека операндов и делит его на 2^k сдвигом вправо,
+  /// округляя к нулю, как DIV. Ставится оптимизатором вместо деления на степень двойки.
+  /// Например: INTEGER_LOAD i; SHIFT_RIGHT 1; // i / 2
+  SHIFT_RIGHT = 31,
+
+  /// Делит значение из стека операндов на положительную константу без деления:
+  /// старшие 64 бита произведения на магический множитель, сдвиг и поправка знака.
+  /// Операнды - множитель и сдвиг, их подбирает оптимизатор по делителю.
+  /// Например: INTEGER_LOAD i; MUL_HIGH_SHIFT 6148914691236517206 0; // i / 3
+  MUL_HIGH_SHIFT = 32,
+
+  /// Заполняет элементы массива с индексами [begin, end) одним значением.
+  /// Берёт из стека begin, затем end, затем значение. Как и цикл, который заменяет, обрабатывает
+  /// элементы до первого индекса за границей массива и сообщает о нём.
+  /// Ставится оптимизатором вместо цикла a[i] = x.
+  /// Например: PUSH 1; INTEGER_LOAD size; PUSH 0; ARRAY_FILL "a"
+  ARRAY_FILL = 33,
+
+  /// Записывает в элементы [begin, end) арифметическую прогрессию: a[k] = offset + step * k.
+  /// Берёт из стека begin, end, step и offset. Ставится вместо цикла a[i] = size - i и подобных.
+  /// Например: INTEGER_LOAD size; PUSH -1; INTEGER_LOAD size; PUSH 0; ARRAY_IOTA "a"
+  ARRAY_IOTA = 34,
+
+  /// Копирует элементы [begin, end) из другого массива в те же позиции: a[k] = b[k].
+  /// Берёт из стека begin, end и указатель массива-источника, второй операнд - его имя для сообщений.
+  /// Например: ARRAY_LOAD "b"; INTEGER_LOAD size; PUSH 0; ARRAY_COPY "a" "b"
+  ARRAY_COPY = 35,
+
+  /// Складывает элементы [begin, end) с начальным значением и кладёт сумму в стек.
+  /// Берёт из стека begin, end и начальное значение. Ставится вместо цикла s = s + a[i].
+  /// Например: INTEGER_LOAD s; INTEGER_LOAD size; PUSH 0; ARRAY_SUM "a"; INTEGER_STORE s
+  ARRAY_SUM = 36,
+
+  /// Минимум из начального значения и элементов [begin, end), операнды как у ARRAY_SUM.
+  /// Ставится вместо цикла if (a[i] < m) { m = a[i]; }
+  ARRAY_MIN = 37,
+
+  /// Максимум из начального значения и элементов [begin, end), операнды как у ARRAY_SUM.
+  ARRAY_MAX = 38
 };
 
 std::string ConvertOperationToString(Operation operation);
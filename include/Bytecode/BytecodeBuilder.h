@@ -26,7 +26,7 @@ class BytecodeBuilder {
   void integerStore(const std::string& Name);
   void arrayStore(const std::string& Name);
   void storeInIndex(const std::string& Name);
-  void newArray();
+  void newArray(const std::string& Function, size_t Line);
 
   void print();
   void funBegin(const std::vector<std::string>& Names);
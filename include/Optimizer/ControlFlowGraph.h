@@ -0,0 +1,160 @@
+#ifndef CONTROL_FLOW_GRAPH_H
+#define CONTROL_FLOW_GRAPH_H
+
+#include <Bytecode/Bytecode.h>
+#include <Optimizer/ExecutionProfile.h>
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Optimizer IR of a single function (FUN_BEGIN ... FUN_END). Instructions keep their bytecode
+// order and ids, passes rewrite them in place or mark them deleted, and Serialize() emits the result.
+//
+// Def-use chains come in two kinds:
+//  - stack: every popped operand is linked to the instruction that pushed it, when both are in one block;
+//  - variables: every load is linked to the stores that reach it (reaching definitions over the CFG).
+
+constexpr int64_t NoInstruction = -1;
+
+struct Instruction {
+  Operation operation;
+  std::vector<std::string> operands;
+  bool isDeleted = false;
+  size_t block = 0;
+
+  // Producers of the popped values, top of the stack first. NoInstruction if the value
+  // comes from another block or the producer is unknown
+  std::vector<int64_t> inputs;
+  // Consumer of the pushed value, NoInstruction if it's outside the block or never consumed
+  int64_t user = NoInstruction;
+
+  // Loads: stores reaching them; isReachedByEntry if the function entry (parameter or no store) does too.
+  // Stores: loads they reach
+  std::vector<int64_t> definitions;
+  std::vector<int64_t> uses;
+  bool isReachedByEntry = false;
+};
+
+// Variables live at block boundaries, integer and array variables are keyed separately
+struct Liveness {
+  std::map<std::pair<bool, std::string>, size_t> variables; // (is array, name) -> index
+  std::vector<std::vector<bool>> liveIn;
+  std::vector<std::vector<bool>> liveOut;
+};
+
+struct BasicBlock {
+  int64_t begin = 0; // First instruction
+  int64_t end = 0;   // Past the last instruction
+  std::vector<int64_t> successors;
+  std::vector<int64_t> predecessors;
+};
+
+// Natural loop: the header and every block reaching a back edge to it without passing through it
+struct Loop {
+  int64_t header = 0;
+  std::vector<int64_t> blocks; // Sorted, the header included
+  std::vector<int64_t> latches; // Sources of the back edges
+};
+
+// Loop header "LABEL; push x; push y; CMP; JUMP_cc exit" leaving the loop once i >= bound (i > bound if inclusive),
+// i being an integer variable and the bound a constant or another integer variable
+struct LoopCondition {
+  int64_t label = 0;
+  int64_t load = 0;  // INTEGER_LOAD of i
+  int64_t bound = 0; // PUSH or INTEGER_LOAD
+  int64_t exit = 0;  // JUMP_cc
+  std::string variable;
+  bool isInclusive = false;
+};
+
+class ControlFlowGraph {
+ public:
+  std::vector<Instruction> instructions;
+  std::vector<BasicBlock> blocks;
+  std::map<std::string, int64_t> labels; // label -> LABEL instruction
+  std::vector<std::string> integerParams;
+  std::vector<std::string> arrayParams;
+  // Counts from an earlier run of the function (--profile-in), nullptr without one
+  const ExecutionProfile::Function* profile = nullptr;
+
+  // Arities of callees, calls to unknown functions stop stack tracking in their block.
+  // Pure callees (see Optimizer::findPureFunctions) may be moved like arithmetic, unused calls of the terminating
+  // ones are dropped.
+  ControlFlowGraph(const std::vector<std::pair<Operation, std::vector<std::string>>>& function,
+                   const std::map<std::string, size_t>& arities,
+                   const std::set<std::string>& pureFunctions = {},
+                   const std::set<std::string>& terminatingFunctions = {},
+                   const ExecutionProfile::Function* profile = nullptr);
+
+  [[nodiscard]] std::vector<std::pair<Operation, std::vector<std::string>>> Serialize() const;
+  // Rebuilds blocks and chains from the live instructions, after a pass changed control flow
+  void Rebuild();
+
+  [[nodiscard]] Liveness ComputeLiveness() const;
+  // Innermost loops first
+  [[nodiscard]] std::vector<Loop> FindLoops() const;
+  // LABEL of the loop header when the header is entered from outside only by falling through from the block
+  // before it: code inserted before the label then runs once on the way into the loop. NoInstruction otherwise
+  [[nodiscard]] int64_t PreheaderPosition(const Loop& loop) const;
+  // Whether the loop header only checks i < bound or i <= bound, from either side of CMP
+  [[nodiscard]] bool MatchLoopCondition(const Loop& loop, LoopCondition& condition) const;
+
+  // Variable a load or a store refers to: integer and array variables live in separate namespaces
+  [[nodiscard]] static bool IsVariableLoad(Operation operation);
+  [[nodiscard]] static bool IsVariableStore(Operation operation);
+  [[nodiscard]] static bool IsArrayVariable(Operation operation);
+  [[nodiscard]] static bool IsJump(Operation operation);
+  // ARRAY_FILL ... ARRAY_MAX, the loops IdiomRecognition replaces
+  [[nodiscard]] static bool IsBulkArrayOperation(Operation operation);
+  // Changes elements of the array in its variable
+  [[nodiscard]] static bool IsArrayWrite(Operation operation);
+  // Live PUSH instruction
+  [[nodiscard]] bool IsConstant(int64_t id) const;
+  [[nodiscard]] int64_t ConstantValue(int64_t id) const;
+  // lhs op rhs with the VM's wrap-around, false for a division that traps
+  static bool Evaluate(Operation operation, int64_t lhs, int64_t rhs, int64_t& result);
+  // (pops, pushes), pops = -1 for a call of an unknown function
+  [[nodiscard]] std::pair<int64_t, int64_t> StackEffect(const Instruction& instruction) const;
+  // The same for code outside a graph, arity is the param count of the function a FUN_CALL calls or -1
+  [[nodiscard]] static std::pair<int64_t, int64_t> StackEffect(Operation operation, int64_t arity);
+
+  // Call of a pure function of known arity
+  [[nodiscard]] bool IsPureCall(const Instruction& instruction) const;
+  [[nodiscard]] bool IsTrappingDivision(const Instruction& instruction) const;
+  // Index is a constant inside every array that may be in the variable
+  [[nodiscard]] bool IsProvenInBounds(const Instruction& load) const;
+  // Whether the value can be dropped with everything that computes it: no output, no traps, no calls that may not
+  // return.
+  // Appends the instructions computing it to the tree
+  bool CollectRemovableTree(int64_t root, std::vector<int64_t>& tree) const;
+
+  // Deletes the instruction and unlinks it from the variable def-use chains
+  void Delete(int64_t id);
+  // Deletes the instruction with the expressions computing its operands, if those can be dropped
+  bool DeleteWithInputs(int64_t id);
+  // Turns the instruction into PUSH value, dropping its inputs (they must be deleted by the caller)
+  void ReplaceWithConstant(int64_t id, int64_t value);
+  // Code emitted by Serialize() right before the instruction; Rebuild() turns it into instructions
+  void InsertBefore(int64_t id, const std::vector<std::pair<Operation, std::vector<std::string>>>& code);
+  // Integer variable name no one in the function uses, for values the optimizer keeps around
+  [[nodiscard]] std::string NewTemporary();
+  // Label no one in the function uses
+  [[nodiscard]] std::string NewLabel();
+
+ private:
+  std::map<std::string, size_t> arities;
+  std::set<std::string> pureFunctions;
+  std::set<std::string> terminatingFunctions;
+  std::map<int64_t, std::vector<std::pair<Operation, std::vector<std::string>>>> insertions;
+  int64_t temporariesCount = -1;
+  int64_t labelsCount = -1;
+
+  void BuildBlocks();
+  void BuildStackChains();
+  void BuildVariableChains();
+};
+
+#endif //CONTROL_FLOW_GRAPH_H
@@ -0,0 +1,60 @@
+#ifndef EXECUTION_PROFILE_H
+#define EXECUTION_PROFILE_H
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// What a run of the program did, written with --profile-out and fed to the optimizer with --profile-in.
+// Branches and loops are keyed by the labels of the unoptimized code, so a profile written by an optimized run
+// describes the same jumps. Jumps the optimizer retargets keep the key in their operands (see BranchKey),
+// labels it makes contain '$' and aren't recorded.
+struct ExecutionProfile {
+  // Conditional jumps counted as the branch at the label, all jumps with one key are counted together
+  struct Branch {
+    int64_t taken = 0;
+    int64_t notTaken = 0;
+  };
+
+  // Loop with its header at the label: entries from outside and back edges taken
+  struct Loop {
+    int64_t entries = 0;
+    int64_t iterations = 0;
+  };
+
+  struct Function {
+    int64_t calls = 0;
+    std::map<std::string, Branch> branches;
+    std::map<std::string, Loop> loops;
+
+    // Counts of the conditional jump with the operands, swapped if it is inverted. False if there are none
+    bool FindBranch(const std::vector<std::string>& operands, Branch& branch) const;
+  };
+
+  std::map<std::string, Function> functions;
+
+  // "function NAME CALLS" lines, each followed by "branch LABEL TAKEN NOT_TAKEN" and
+  // "loop LABEL ENTRIES ITERATIONS" lines of that function. Read returns false on malformed input
+  void Write(std::ostream& out) const;
+  bool Read(std::istream& in);
+
+  // "JUMP_xx label [key [inverted]]": the branch a conditional jump is counted as, its label by default.
+  // Inverted jumps are taken when the source branch isn't
+  static const std::string& BranchKey(const std::vector<std::string>& operands);
+  static bool IsInvertedBranch(const std::vector<std::string>& operands);
+  // Operands of the jump to the label with the condition inverted, counted as the same branch
+  static std::vector<std::string> InvertedBranch(const std::vector<std::string>& operands, const std::string& label);
+  // "JUMP label key iterations exit [inverted]": back edge of an unrolled copy standing for that many iterations of
+  // the loop at key, each not taking the exit branch (taking it if inverted). Zero iterations for other jumps
+  static int64_t UnrolledIterations(const std::vector<std::string>& operands);
+  static bool IsRecordedKey(const std::string& key);
+  // Clones made by specialization ("name$...") are counted as the function they copy
+  static std::string SourceFunction(const std::string& name);
+  // Key of the jumps the optimizer adds, neither branches nor back edges of the source
+  inline static const std::string UnrecordedKey = "$";
+};
+
+#endif //EXECUTION_PROFILE_H
@@ -1,14 +1,77 @@
 #ifndef OPTIMIZER_H
 #define OPTIMIZER_H
 
+#include <map>
+#include <set>
 #include <vector>
 #include <string>
 
 #include <Bytecode/Bytecode.h>
+#include <Optimizer/ExecutionProfile.h>
+
+// What the optimizer knows about the other functions of the program
+struct ProgramInfo {
+  // Arities let the optimizer follow values through calls, calls of pure functions can be moved out of loops
+  std::map<std::string, size_t> arities;
+  std::set<std::string> pureFunctions;
+  // Pure functions that always return, unused calls of them can be dropped
+  std::set<std::string> terminatingFunctions;
+  // Bodies (FUN_BEGIN ... FUN_END) the inliner may copy and how many times each function has been called
+  std::map<std::string, const std::vector<std::pair<Operation, std::vector<std::string>>>*> bodies;
+  std::map<std::string, int64_t> callCounts;
+  // Branch and loop counts of an earlier run, functions without them keep their layout
+  ExecutionProfile profile;
+};
+
+// Ahead-of-time optimization before the program runs (-O0 / -O1 / -O2), hot functions are optimized at run time anyway
+enum OptimizationLevel {
+  NO_OPTIMIZATION,     // Only functions the profile of an earlier run shows hot
+  LOCAL_OPTIMIZATION,  // Every function on its own: the CFG passes without inlining
+  FULL_OPTIMIZATION    // Inlining as well, callees are optimized before their callers
+};
 
 class Optimizer {
  public:
-  static void optimize(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode);
+  // Optimizes a single function (FUN_BEGIN ... FUN_END) on its control flow graph and inlines calls.
+  static void optimize(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+                       const ProgramInfo& program = {}, bool isInliningEnabled = true);
+
+  // Optimizes every function of the program at the given level. With a profile of an earlier run, inlining follows
+  // its call counts, branches are laid out by it and hot functions are optimized fully even at NO_OPTIMIZATION.
+  // Works on the whole program.
+  static void optimizeProgram(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+                              OptimizationLevel level, const ExecutionProfile& profile = {});
+
+  // Replaces calls of small or hot functions with their bodies, locals and labels renamed.
+  // Callees are ordered by call count and the function grows within a budget. Returns whether any call was inlined.
+  static bool inlineCalls(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+                          const ProgramInfo& program);
+
+  // Clones functions for the constants passed to their integer params at call sites in loops or of callees the
+  // profile shows hot, redirects those calls and optimizes the clones. Clones add at most half the program size.
+  // Works on the whole program, returns whether any call was redirected.
+  static bool specializeFunctions(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+                                  const ProgramInfo& program);
+
+  // Functions without observable effects whose result depends only on their integer arguments:
+  // no output, no arrays, no division that can trap, calls only to such functions.
+  // They may not terminate: calls are never moved where they didn't run. Works on the whole program.
+  static std::set<std::string> findPureFunctions(
+      const std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode);
+
+  // Pure functions without loops that call only such functions and none of them back, so every call returns.
+  // Works on the whole program.
+  static std::set<std::string> findTerminatingFunctions(
+      const std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+      const std::set<std::string>& pureFunctions);
+
+  // Replaces NEW_ARRAY with NEW_LOCAL_ARRAY for arrays that never leave their function
+  // (not returned, not stored, not passed to a parameter that escapes). Works on the whole program.
+  static void escapeAnalysis(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode);
+
+  // Replaces LOAD_FROM_INDEX / STORE_IN_INDEX with unchecked versions where the index is a counting loop
+  // variable bounded by the array length (or a constant not above it)
+  static void boundsCheckElimination(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode);
 };
 
 #endif //OPTIMIZER_H
@@ -0,0 +1,71 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include <Optimizer/ControlFlowGraph.h>
+#include <Optimizer/Optimizer.h>
+
+// Passes over the control flow graph of a single function, run by Optimizer::optimize.
+// Each returns whether it changed anything.
+
+// Sparse conditional constant propagation: integer variables and stack values that are constant
+// on every executable path become PUSH, branches on constant conditions are resolved and
+// blocks no executable edge reaches are deleted. Rebuilds the graph when control flow changes.
+bool SparseConditionalConstantPropagation(ControlFlowGraph& graph);
+
+// Calls of pure functions with constant arguments are run at compile time by an interpreter with
+// limited fuel and replaced by PUSH of the result. Gives up on anything the callee can't finish.
+bool PureCallEvaluation(ControlFlowGraph& graph, const ProgramInfo& program);
+
+// Counted loops for (; i < bound; i = i + 1) that fill an array, store a progression in i (a[i] = size - i),
+// copy a[i] = b[i] or sum / take the minimum or maximum of b[i] into a variable become one bulk opcode
+// (ARRAY_FILL ... ARRAY_MAX) over [i, bound) followed by i = bound. Rebuilds the graph.
+bool IdiomRecognition(ControlFlowGraph& graph);
+
+// Linear self-recursion whose calls are returned as is or combined by ADD / MUL with a value computed
+// before them (n * f(n - 1)) becomes a loop: the calls store the arguments into the params and jump back to
+// the start, the combined values go to an accumulator every RETURN applies. Rebuilds the graph.
+bool RecursionToLoop(ControlFlowGraph& graph);
+
+// Deletes stores of variables that are dead after them (liveness over the CFG) together with
+// the expressions computing the stored values, when those have no side effects
+bool DeadStoreElimination(ControlFlowGraph& graph);
+
+// An array nobody reads is dropped with all its stores, but only all at once:
+// a store left behind would index an array that was never allocated. Element stores into a variable that
+// may hold an array allocated elsewhere keep it, and so do stores that may trap out of bounds
+bool DeadArrayElimination(ControlFlowGraph& graph);
+
+// Deletes blocks unreachable from the entry, jumps to the next instruction and labels nobody
+// jumps to. Rebuilds the graph when anything changes.
+bool UnreachableCodeElimination(ControlFlowGraph& graph);
+
+// Moves expressions with the same value in every iteration of a natural loop into a preheader,
+// computing them once into a temporary: arithmetic, array reads when the loop writes no arrays,
+// calls of pure functions. Handles one loop per run and rebuilds the graph.
+bool LoopInvariantCodeMotion(ControlFlowGraph& graph);
+
+// Products v * c of a basic induction variable (only ever stored as v = v +- step with an invariant step)
+// are kept in a temporary updated next to every store of v, when that takes fewer instructions.
+// Handles one loop per run and rebuilds the graph.
+bool InductionVariableStrengthReduction(ControlFlowGraph& graph);
+
+// Global value numbering: pure expressions (arithmetic, array reads, pure calls) computed again while
+// available on every path are replaced by a temporary, which the first computations store into.
+// Rebuilds the graph.
+bool CommonSubexpressionElimination(ControlFlowGraph& graph);
+
+// Counted loops with a one-block body (i < bound or i <= bound, i only incremented by a positive constant) get
+// an unrolled copy in front of them running the body 2, 4 or 8 times per check, the loop itself is left for the
+// remaining iterations. The factor follows the body size and a constant or profiled trip count. Rebuilds the graph.
+bool LoopUnrolling(ControlFlowGraph& graph);
+
+// Reorders blocks by the profile so that the more frequent side of every branch falls through, inverting
+// conditions and adding jumps where the order changed. Blocks the profiled run never reached go to the end of
+// the function. Needs the graph's profile, rebuilds the graph.
+bool BlockLayout(ControlFlowGraph& graph);
+
+// Lowers multiplication and division by constants: powers of two become SHIFT_LEFT / SHIFT_RIGHT,
+// other positive divisors MUL_HIGH_SHIFT. The other passes don't look into these, so it runs last.
+bool StrengthReduction(ControlFlowGraph& graph);
+
+#endif //PASSES_H
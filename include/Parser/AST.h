@@ -453,8 +453,9 @@ class IntegerLiteralAST : public FactorAST {
 class ArrayInitializationAST : public FactorAST {
  public:
   ExpressionAST* Expr;
+  size_t Line;
 
-  explicit ArrayInitializationAST(ExpressionAST* Expr) : Expr(Expr) {}
+  explicit ArrayInitializationAST(ExpressionAST* Expr, size_t Line) : Expr(Expr), Line(Line) {}
   void accept(ASTVisitor& V) override {
     V.visit(*this);
   }
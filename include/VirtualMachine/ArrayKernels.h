@@ -0,0 +1,30 @@
+#ifndef ARRAY_KERNELS_H
+#define ARRAY_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Elements of an array range: count values stride bytes apart. Large objects keep them contiguous,
+// the heap interleaves them with the allocation flags of its cells
+struct ArrayCells {
+  char* first = nullptr;
+  std::ptrdiff_t stride = sizeof(int64_t);
+  int64_t count = 0;
+};
+
+// Bulk opcodes ARRAY_FILL ... ARRAY_MAX. Arithmetic wraps around like the VM's.
+// AVX2 versions are chosen once at startup if the CPU has it, scalar ones otherwise
+namespace ArrayKernels {
+
+void Fill(const ArrayCells& cells, int64_t value);
+// cells[k] = first + step * k
+void Iota(const ArrayCells& cells, int64_t first, int64_t step);
+// Ranges of the same length, the same one or not overlapping
+void Copy(const ArrayCells& destination, const ArrayCells& source);
+int64_t Sum(const ArrayCells& cells, int64_t initial);
+int64_t Min(const ArrayCells& cells, int64_t initial);
+int64_t Max(const ArrayCells& cells, int64_t initial);
+
+}
+
+#endif //ARRAY_KERNELS_H
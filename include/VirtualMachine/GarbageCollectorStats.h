@@ -0,0 +1,39 @@
+#ifndef GARBAGE_COLLECTOR_STATS_H
+#define GARBAGE_COLLECTOR_STATS_H
+
+#include <VirtualMachine/Heap.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+struct GarbageCollectorStats {
+  struct Collection {
+    int64_t pauseNanoseconds = 0;
+    int64_t liveCells = 0;
+    int64_t freedCells = 0;
+    double fragmentation = 0;
+    bool isCompacted = false;
+  };
+
+  // Bucket i counts pauses in [2^i, 2^(i + 1)) microseconds, the first one also takes shorter pauses
+  static constexpr size_t PauseBuckets = 32;
+
+  std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+  std::vector<Collection> collections;
+  std::vector<int64_t> pauses;
+  std::array<int64_t, PauseBuckets> pauseHistogram{};
+  int64_t compactions = 0;
+  // Deferred reference counting mode
+  int64_t referenceCountingReclaims = 0;
+  int64_t referenceCountingFreedCells = 0;
+
+  void RecordPause(int64_t pauseNanoseconds);
+
+  void PrintSummary(std::ostream& out, const Heap& heap) const;
+  void WriteJson(std::ostream& out, const Heap& heap) const;
+};
+
+#endif //GARBAGE_COLLECTOR_STATS_H
@@ -5,36 +5,146 @@
 #ifndef HEAP_H
 #define HEAP_H
 
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
+#include <vector>
+
+#include <VirtualMachine/ArrayKernels.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
 
 struct Heap {
   struct HeapMemoryUnit {
     bool isAllocated = false;
+    // Header of an allocated block, kept in the padding so the collector can tell a pointer from an integer
+    bool isBlockStart = false;
     int64_t value = 0;
   };
 
   HeapMemoryUnit* heap;
   int64_t size;
 
-  explicit Heap(int64_t size) {
+  // Frame-local arrays live in [size, size + localRegionSize) and are bump-allocated,
+  // so the whole region of a stack frame is released at once on RETURN.
+  int64_t localRegionSize;
+  int64_t localRegionTop;
+
+  // Sweeping is lazy: cells below sweepFrontier are swept, cells above it are garbage
+  // unless marked by the last collection. The allocator sweeps a page once it reaches it
+  // and clears its marks, so the next collection starts with a clean bitmap.
+  static constexpr int64_t PageSize = 4096;
+  std::vector<uint8_t> marked;
+  int64_t sweepFrontier;
+
+  // Arrays of at least LargeObjectThreshold cells get their own anonymous mapping, zeroed by the kernel.
+  // Pointer to such an array is LargeObjectBase + slot * LargeObjectStride + 1, and the header is kept
+  // at offset 0 like in the heap. Freed mappings are kept for reuse after MADV_DONTNEED or unmapped.
+  static constexpr int64_t LargeObjectThreshold = int64_t(1) << 16;
+  static constexpr int64_t LargeObjectBase = int64_t(1) << 40;
+  static constexpr int64_t LargeObjectStride = int64_t(1) << 32;
+  static constexpr size_t LargeObjectCacheSize = 4;
+
+  struct LargeObject {
+    int64_t* memory = nullptr;
+    size_t mappedBytes = 0;
+    bool isMarked = false;
+  };
+
+  std::vector<LargeObject> largeObjects;
+  std::vector<int64_t> freeLargeObjectSlots;
+  std::vector<std::pair<int64_t*, size_t>> cachedMappings;
+  // Cells held by large objects, allocation fails past the limit so the collector gets a chance to run
+  int64_t largeObjectCells = 0;
+  int64_t largeObjectLimit;
+
+  // Allocation counters for GC statistics, usedCells is updated by the collector after marking
+  int64_t allocations = 0;
+  int64_t allocatedCells = 0;
+  int64_t usedCells = 0;
+  int64_t localAllocations = 0;
+  int64_t localAllocatedCells = 0;
+
+  explicit Heap(int64_t size, int64_t localRegionSize = 0) {
     this->size = size;
-    this->heap = new HeapMemoryUnit[size];
+    this->localRegionSize = localRegionSize;
+    this->localRegionTop = size;
+    this->sweepFrontier = size;
+    this->largeObjectLimit = size;
+    this->heap = new HeapMemoryUnit[size + localRegionSize];
+    this->marked.assign(size, 0);
+  }
+
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+
+  ~Heap() {
+    for (auto& object : largeObjects) {
+      if (object.memory)
+        munmap(object.memory, object.mappedBytes);
+    }
+    for (auto& [memory, mappedBytes] : cachedMappings)
+      munmap(memory, mappedBytes);
+    delete[] heap;
+  }
+
+  // Marks left above the frontier by the last collection, cleared before marking again
+  void ClearUnsweptMarks() {
+    std::fill(marked.begin() + sweepFrontier, marked.end(), 0);
+  }
+
+  void StartSweep() {
+    sweepFrontier = 0;
+  }
+
+  void SweepPage() {
+    int64_t end = std::min(sweepFrontier + PageSize, size);
+    for (int64_t it = sweepFrontier; it < end; ++it) {
+      if (!marked[it])
+        heap[it].isAllocated = false;
+      marked[it] = 0;
+    }
+    sweepFrontier = end;
+  }
+
+  [[nodiscard]] bool IsLiveCell(int64_t index) const {
+    return heap[index].isAllocated && (index < sweepFrontier || marked[index]);
   }
 
-  [[nodiscard]] int64_t AllocateMemory(int64_t neededMemory) const {
+  // Whether the pointer refers to a live array in the heap, without walking the blocks
+  [[nodiscard]] bool IsLiveHeapArray(int64_t pointer) const {
+    return pointer > 0 && pointer <= size && heap[pointer - 1].isBlockStart && IsLiveCell(pointer - 1);
+  }
+
+  [[nodiscard]] int64_t AllocateMemory(int64_t neededMemory) {
     neededMemory++;
+    if (neededMemory > LargeObjectThreshold)
+      return AllocateLargeObject(neededMemory);
+
     int64_t it1 = 0;
     while (it1 < size) {
       int64_t it2 = it1;
 
-      while (it2 < size && !heap[it2].isAllocated && (it2 - it1) != neededMemory)
+      while (it2 < size && (it2 - it1) != neededMemory) {
+        if (it2 >= sweepFrontier)
+          SweepPage();
+        if (heap[it2].isAllocated)
+          break;
         it2++;
+      }
 
       if (it2 - it1 == neededMemory) {
-        for (int64_t it = it1; it < it2; ++it)
+        for (int64_t it = it1; it < it2; ++it) {
           heap[it].isAllocated = true;
+          heap[it].isBlockStart = false;
+          heap[it].value = 0;
+        }
+        heap[it1].isBlockStart = true;
         heap[it1].value = neededMemory;
+        allocations++;
+        allocatedCells += neededMemory;
+        usedCells += neededMemory;
         return it1 + 1;
       }
 
@@ -44,23 +154,208 @@ struct Heap {
     return -1;
   }
 
-  int64_t GetValueByIndex(int64_t index) const {
-    if (index <= 0 || index >= size) {
-//      std::cerr << "Segfault";
+  [[nodiscard]] int64_t AllocateLocalMemory(int64_t neededMemory) {
+    neededMemory++;
+    // Large arrays go to the large object space instead of exhausting the region
+    if (neededMemory > LargeObjectThreshold || localRegionTop + neededMemory > size + localRegionSize)
       return -1;
+
+    int64_t begin = localRegionTop;
+    for (int64_t it = begin; it < begin + neededMemory; ++it) {
+      heap[it].isAllocated = true;
+      heap[it].value = 0;
     }
+    heap[begin].value = neededMemory;
+    localRegionTop += neededMemory;
+    localAllocations++;
+    localAllocatedCells += neededMemory;
+    return begin + 1;
+  }
+
+  void FreeLocalMemory(int64_t regionMark) {
+    localRegionTop = regionMark;
+  }
+
+  [[nodiscard]] bool IsLocalPointer(int64_t pointer) const {
+    return pointer > size && pointer <= size + localRegionSize;
+  }
 
+  [[nodiscard]] int64_t AllocateLargeObject(int64_t neededMemory) {
+    if (neededMemory >= LargeObjectStride || largeObjectCells + neededMemory > largeObjectLimit)
+      return -1;
+
+    auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t bytes = (neededMemory * sizeof(int64_t) + pageSize - 1) / pageSize * pageSize;
+
+    LargeObject object;
+    for (auto it = cachedMappings.begin(); it != cachedMappings.end(); ++it) {
+      if (it->second >= bytes && it->second <= 2 * bytes) {
+        object.memory = it->first;
+        object.mappedBytes = it->second;
+        cachedMappings.erase(it);
+        break;
+      }
+    }
+    if (!object.memory) {
+      void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (memory == MAP_FAILED)
+        return -1;
+      object.memory = static_cast<int64_t*>(memory);
+      object.mappedBytes = bytes;
+    }
+    object.memory[0] = neededMemory;
+    largeObjectCells += neededMemory;
+    allocations++;
+    allocatedCells += neededMemory;
+    usedCells += neededMemory;
+
+    int64_t slot;
+    if (!freeLargeObjectSlots.empty()) {
+      slot = freeLargeObjectSlots.back();
+      freeLargeObjectSlots.pop_back();
+      largeObjects[slot] = object;
+    } else {
+      slot = static_cast<int64_t>(largeObjects.size());
+      largeObjects.push_back(object);
+    }
+
+    return LargeObjectBase + slot * LargeObjectStride + 1;
+  }
+
+  void FreeLargeObject(int64_t slot) {
+    auto& object = largeObjects[slot];
+    largeObjectCells -= object.memory[0];
+    if (cachedMappings.size() < LargeObjectCacheSize) {
+      madvise(object.memory, object.mappedBytes, MADV_DONTNEED);
+      cachedMappings.emplace_back(object.memory, object.mappedBytes);
+    } else {
+      munmap(object.memory, object.mappedBytes);
+    }
+
+    object = LargeObject();
+    freeLargeObjectSlots.push_back(slot);
+  }
+
+  [[nodiscard]] bool IsManagedPointer(int64_t pointer) const {
+    return (pointer > 0 && pointer <= size) || LargeObjectSlot(pointer) != -1;
+  }
+
+  // Length of the array block with the header, 0 if the pointer doesn't refer to an allocated array
+  [[nodiscard]] int64_t BlockLength(int64_t pointer) const {
+    int64_t slot = LargeObjectSlot(pointer);
+    if (slot != -1)
+      return largeObjects[slot].memory[0];
+    if (pointer <= 0 || pointer > size || !heap[pointer - 1].isAllocated)
+      return 0;
+    return heap[pointer - 1].value;
+  }
+
+  // Releases a single array right away, used by reference counting
+  void FreeMemory(int64_t pointer) {
+    int64_t length = BlockLength(pointer);
+    if (length == 0)
+      return;
+
+    usedCells -= length;
+    int64_t slot = LargeObjectSlot(pointer);
+    if (slot != -1) {
+      FreeLargeObject(slot);
+      return;
+    }
+    for (int64_t it = pointer - 1; it < std::min(pointer - 1 + length, size); ++it)
+      heap[it].isAllocated = false;
+  }
+
+  // Slot of the large object the pointer refers to, -1 if there is no such object
+  [[nodiscard]] int64_t LargeObjectSlot(int64_t pointer) const {
+    if (pointer < LargeObjectBase || (pointer - LargeObjectBase) % LargeObjectStride != 1)
+      return -1;
+
+    int64_t slot = (pointer - LargeObjectBase) / LargeObjectStride;
+    if (slot >= static_cast<int64_t>(largeObjects.size()) || !largeObjects[slot].memory)
+      return -1;
+    return slot;
+  }
+
+  [[nodiscard]] int64_t* LargeObjectCell(int64_t index) const {
+    int64_t slot = (index - LargeObjectBase) / LargeObjectStride;
+    int64_t offset = (index - LargeObjectBase) % LargeObjectStride;
+    return largeObjects[slot].memory + offset;
+  }
+
+  // Allocated blocks in address order as (header index, length with the header)
+  [[nodiscard]] std::vector<std::pair<int64_t, int64_t>> AllocatedBlocks() const {
+    std::vector<std::pair<int64_t, int64_t>> blocks;
+    int64_t it = 0;
+    while (it < size) {
+      if (!IsLiveCell(it)) {
+        it++;
+        continue;
+      }
+
+      int64_t length = std::max<int64_t>(heap[it].value, 1);
+      blocks.emplace_back(it, length);
+      it += length;
+    }
+
+    return blocks;
+  }
+
+  // (total free cells, longest free run)
+  [[nodiscard]] std::pair<int64_t, int64_t> FreeSpace() const {
+    int64_t freeCells = 0;
+    int64_t longestRun = 0;
+    int64_t currentRun = 0;
+    for (int64_t it = 0; it < size; ++it) {
+      if (IsLiveCell(it)) {
+        currentRun = 0;
+        continue;
+      }
+      freeCells++;
+      currentRun++;
+      longestRun = std::max(longestRun, currentRun);
+    }
+
+    return {freeCells, longestRun};
+  }
+
+  // Number of elements read from the array header, -1 if the pointer doesn't refer to an array
+  [[nodiscard]] int64_t ArrayLength(int64_t pointer) const {
+    if (pointer >= LargeObjectBase) {
+      int64_t slot = LargeObjectSlot(pointer);
+      return slot == -1 ? -1 : largeObjects[slot].memory[0] - 1;
+    }
+    if (pointer <= 0 || pointer > size + localRegionSize || !heap[pointer - 1].isAllocated)
+      return -1;
+    return heap[pointer - 1].value - 1;
+  }
+
+  [[nodiscard]] bool IsInBounds(int64_t pointer, int64_t index) const {
+    return index >= 0 && index < ArrayLength(pointer);
+  }
+
+  // Element access doesn't check anything: the VM checks IsInBounds first,
+  // unless the optimizer proved the index is within the array
+  [[nodiscard]] int64_t GetValueByIndex(int64_t index) const {
+    if (index >= LargeObjectBase)
+      return *LargeObjectCell(index);
     return heap[index].value;
   }
 
   void SetValueByIndex(int64_t index, int64_t value) const {
-    if (index <= 0 || index >= size) {
-//      std::cerr << "Segfault" << std::endl;
+    if (index >= LargeObjectBase) {
+      *LargeObjectCell(index) = value;
       return;
     }
-
     heap[index].value = value;
   }
+
+  // Elements [begin, begin + count) of the array for the bulk kernels, the range must be in bounds
+  [[nodiscard]] ArrayCells ElementCells(int64_t pointer, int64_t begin, int64_t count) const {
+    if (pointer >= LargeObjectBase)
+      return {reinterpret_cast<char*>(LargeObjectCell(pointer + begin)), sizeof(int64_t), count};
+    return {reinterpret_cast<char*>(&heap[pointer + begin].value), sizeof(HeapMemoryUnit), count};
+  }
 };
 
 #endif //HEAP_H
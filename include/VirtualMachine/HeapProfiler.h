@@ -0,0 +1,52 @@
+#ifndef HEAP_PROFILER_H
+#define HEAP_PROFILER_H
+
+#include <csignal>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Attributes allocations to the `new array[...]` that made them. Every distinct call stack
+// ending at an allocation site is a separate entry, so the report can be fed to flame graph tools.
+class HeapProfiler {
+  struct Site {
+    std::string function;
+    int64_t line = 0;
+    int64_t allocations = 0;
+    int64_t cells = 0;
+    int64_t survivingCells = 0;
+  };
+
+  struct TrackedArray {
+    size_t site = 0;
+    int64_t cells = 0;
+    bool hasSurvived = false;
+  };
+
+  // Folded call stack -> site
+  std::map<std::string, size_t> siteIndices;
+  std::vector<Site> sites;
+  // Heap arrays that may still be alive, by pointer
+  std::unordered_map<int64_t, TrackedArray> trackedArrays;
+
+ public:
+  // Set from a signal handler, the VM writes the report at the next instruction
+  static volatile std::sig_atomic_t isReportRequested;
+
+  void RecordAllocation(int64_t pointer, int64_t cells, const std::string& stack, const std::string& function,
+                        int64_t line, bool isTracked);
+  void ForgetArray(int64_t pointer);
+  // Called after marking: arrays reported as live survived the collection, the rest are dropped
+  void RetainLiveArrays(const std::function<bool(int64_t)>& isLive);
+  void MoveArrays(const std::function<int64_t(int64_t)>& forward);
+
+  // "frame;frame;function:line cells" lines, one per call stack
+  void WriteFoldedStacks(std::ostream& out, bool isSurvivingOnly) const;
+  void PrintSummary(std::ostream& out) const;
+};
+
+#endif //HEAP_PROFILER_H
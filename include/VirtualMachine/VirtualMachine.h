@@ -7,6 +7,8 @@
 
 #include <Bytecode/Bytecode.h>
 #include <VirtualMachine/Heap.h>
+#include <VirtualMachine/GarbageCollectorStats.h>
+#include <VirtualMachine/HeapProfiler.h>
 #include <Optimizer/Optimizer.h>
 
 #include <vector>
@@ -16,15 +18,72 @@
 #include <iostream>
 #include <memory>
 #include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
 
 class VirtualMachine;
 
+enum MemoryMode {
+  TRACING,
+  REFERENCE_COUNTING
+};
+
 class GarbageCollector {
   std::weak_ptr<VirtualMachine> vm;
+  Heap* heap;
+  MemoryMode memoryMode;
+
+  // Worker pool for parallel marking and sweeping, the calling thread is worker 0
+  size_t threadsCount;
+  std::vector<std::thread> workers;
+  std::mutex poolMutex;
+  std::condition_variable poolWakeUp;
+  std::condition_variable poolDone;
+  std::function<void(size_t)> poolTask;
+  int64_t poolGeneration = 0;
+  size_t runningWorkers = 0;
+  bool isStopping = false;
+
+  // Compaction runs after a collection once 1 - (longest free run / free cells) reaches this value
+  double compactionThreshold = 0.5;
+  GarbageCollectorStats stats;
+
+  // Deferred reference counting: only array variable slots are counted. Arrays whose count drops to zero
+  // wait in the zero count table until a scan of the operand stacks proves nothing else refers to them.
+  // Tracing collection is kept as a backup for references the counts can't see.
+  static constexpr size_t ZeroCountTableLimit = 1024;
+  std::unordered_map<int64_t, int64_t> referenceCounts;
+  std::unordered_set<int64_t> zeroCountTable;
+  int64_t zeroCountCells = 0;
+
+  void WorkerLoop(size_t workerId);
+  void RunInParallel(const std::function<void(size_t)>& task);
+
+  std::vector<int64_t> FindPinnedArrays(VirtualMachine& machine);
+  std::vector<std::pair<int64_t, int64_t>> Mark(VirtualMachine& machine, const std::vector<int64_t>& pinned,
+                                                std::vector<uint8_t>& marked);
+  void FinishSweep(VirtualMachine& machine);
+  void Compact(VirtualMachine& machine, const std::vector<int64_t>& pinned);
+  void RebuildReferenceCounts(VirtualMachine& machine);
  public:
-  explicit GarbageCollector(const std::shared_ptr<VirtualMachine>& vm) : vm(vm) {}
+  explicit GarbageCollector(const std::shared_ptr<VirtualMachine>& vm, size_t threadsCount = 1,
+                            MemoryMode memoryMode = TRACING);
+  ~GarbageCollector();
 
   void CollectGarbage();
+  void CompactHeap();
+
+  [[nodiscard]] bool IsReferenceCounting() const { return memoryMode == REFERENCE_COUNTING; }
+  void AddReference(int64_t pointer);
+  void RemoveReference(int64_t pointer);
+  void TrackAllocation(int64_t pointer);
+  void ReclaimZeroCountArrays(bool isForced);
+
+  [[nodiscard]] const GarbageCollectorStats& getStats() const { return stats; }
 };
 
 enum ValueType {
@@ -41,12 +100,44 @@ struct FunctionContext {
   Bytecode bytecode;
 };
 
+// Operand values are untyped, the collector scans them conservatively through the underlying container
+struct OperandStack : std::stack<int64_t> {
+  using std::stack<int64_t>::c;
+};
+
+// Results of a pure function (see Optimizer::findPureFunctions) by its arguments. The cache is tried for a window
+// of calls and kept only if enough of them hit, one that didn't pay off gets another trial later
+struct MemoCache {
+  struct ArgumentsHash {
+    size_t operator()(const std::vector<int64_t>& arguments) const {
+      size_t hash = arguments.size();
+      for (int64_t argument : arguments)
+        hash ^= std::hash<int64_t>()(argument) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+      return hash;
+    }
+  };
+
+  static constexpr size_t Capacity = 4096;
+  static constexpr int64_t TrialCalls = 1024;
+  static constexpr int64_t RetryCalls = 65536;
+
+  std::unordered_map<std::vector<int64_t>, int64_t, ArgumentsHash> results;
+  bool isEnabled = true;
+  // Since the current window started
+  int64_t calls = 0;
+  int64_t hits = 0;
+};
+
 struct StackFrame {
-  std::stack<int64_t> operandStack;
+  OperandStack operandStack;
   std::map<std::string, int64_t> integerVariables;
   std::map<std::string, int64_t> arrayVariables;
   FunctionContext functionContext;
   int64_t currentPos = 0;
+  int64_t localRegionMark = 0;
+  // Cache the result goes to on return, for a pure function called with memoization on
+  MemoCache* memoCache = nullptr;
+  std::vector<int64_t> memoArguments;
 };
 
 struct CompareResult {
@@ -66,6 +157,13 @@ struct ProfilingContext {
   std::set<std::string> optimizedFunctions;
   std::map<std::string, int64_t> functionCalls;
   int64_t callThreshold = 1000;
+  // Branches and loops are counted only for --profile-out. Until written, loop entries count every arrival
+  // at the label, back edges included
+  bool isRecording = false;
+  ExecutionProfile recorded;
+  // Profile of an earlier run (--profile-in) the optimizer lays out code by
+  ExecutionProfile previous;
+  std::unordered_map<std::string, MemoCache> memoCaches;
 };
 
 class VirtualMachine : public std::enable_shared_from_this<VirtualMachine>  {
@@ -76,29 +174,69 @@ class VirtualMachine : public std::enable_shared_from_this<VirtualMachine>  {
   int64_t returnCode = 0;
   CompareResult compareResult;
   ProfilingContext profilingContext;
+  std::set<std::string> pureFunctions;
+  std::set<std::string> terminatingFunctions;
+  std::unique_ptr<HeapProfiler> heapProfiler;
+  std::string heapProfileFile;
   friend class GarbageCollector;
+
+  [[nodiscard]] std::string CurrentCallStack() const;
+  [[nodiscard]] ExecutionProfile::Function& RecordedFunction() {
+    auto& name = callStack.back().functionContext.functionName;
+    return profilingContext.recorded.functions[ExecutionProfile::SourceFunction(name)];
+  }
+  void ConditionalJump(std::vector<std::string>& operands, bool isTaken);
+  // End of the elements of [begin, end) before the first index out of the array: a bulk opcode processes them
+  // and reports that index like the loop it replaces would
+  [[nodiscard]] int64_t InBoundsEnd(int64_t pointer, int64_t begin, int64_t end) const;
+  // Replaces the call with the cached result if there is one, otherwise prepares the frame to fill the cache
+  bool CallMemoized(const std::string& functionName, size_t arity, StackFrame& newStackFrame);
  public:
   VirtualMachine(int64_t heapSize, const Bytecode& bytecode);
   void Execute();
   void EmergencyTermination();
+  void IndexOutOfBounds(const std::string& arrayName, int64_t pointer, int64_t index);
   [[nodiscard]] int64_t getReturnCode() const { return returnCode; }
-  void InitializeGarbageCollector() {
-    garbageCollector = std::make_shared<GarbageCollector>(shared_from_this());
+  void InitializeGarbageCollector(size_t threadsCount = 1, MemoryMode memoryMode = TRACING) {
+    garbageCollector = std::make_shared<GarbageCollector>(shared_from_this(), threadsCount, memoryMode);
+  }
+  void PrintGarbageCollectorStats(std::ostream& out) const {
+    garbageCollector->getStats().PrintSummary(out, heap);
+  }
+  void WriteGarbageCollectorStats(std::ostream& out) const {
+    garbageCollector->getStats().WriteJson(out, heap);
+  }
+  void EnableHeapProfiler(const std::string& file) {
+    heapProfiler = std::make_unique<HeapProfiler>();
+    heapProfileFile = file;
   }
+  void WriteHeapProfile() const;
+  void EnableProfileRecording() { profilingContext.isRecording = true; }
+  void UseProfile(const ExecutionProfile& profile) { profilingContext.previous = profile; }
+  void WriteProfile(std::ostream& out) const;
 
   void Add(std::vector<std::string>& operands);
   void Sub(std::vector<std::string>& operands);
   void Mul(std::vector<std::string>& operands);
   void Div(std::vector<std::string>& operands);
   void Mod(std::vector<std::string>& operands);
+  void ShiftLeft(std::vector<std::string>& operands);
+  void ShiftRight(std::vector<std::string>& operands);
+  void MulHighShift(std::vector<std::string>& operands);
 
   void Push(std::vector<std::string>& operands);
   void IntegerLoad(std::vector<std::string>& operands);
   void ArrayLoad(std::vector<std::string>& operands);
   void LoadFromIndex(std::vector<std::string>& operands);
+  void LoadFromIndexUnchecked(std::vector<std::string>& operands);
   void IntegerStore(std::vector<std::string>& operands);
   void ArrayStore(std::vector<std::string>& operands);
   void StoreInIndex(std::vector<std::string>& operands);
+  void StoreInIndexUnchecked(std::vector<std::string>& operands);
+  void ArrayFill(std::vector<std::string>& operands);
+  void ArrayIota(std::vector<std::string>& operands);
+  void ArrayCopy(std::vector<std::string>& operands);
+  void ArrayReduce(std::vector<std::string>& operands, Operation operation);
 
   void Jump(std::vector<std::string>& operands);
   void Cmp(std::vector<std::string>& operands);
@@ -110,6 +248,7 @@ class VirtualMachine : public std::enable_shared_from_this<VirtualMachine>  {
   void JumpGE(std::vector<std::string>& operands);
 
   void NewArray(std::vector<std::string>& operands);
+  void NewLocalArray(std::vector<std::string>& operands);
   void Print(std::vector<std::string>& operands);
   void CallFunction(std::vector<std::string>& operands);
   void Return(std::vector<std::string>& operands);
@@ -29,5 +29,17 @@ std::string ConvertOperationToString(Operation operation) {
     case JUMP_GE: return "JUMP_GE";
     case FUN_BEGIN: return "FUN_BEGIN";
     case FUN_END: return "FUN_END";
+    case NEW_LOCAL_ARRAY: return "NEW_LOCAL_ARRAY";
+    case LOAD_FROM_INDEX_UNCHECKED: return "LOAD_FROM_INDEX_UNCHECKED";
+    case STORE_IN_INDEX_UNCHECKED: return "STORE_IN_INDEX_UNCHECKED";
+    case SHIFT_LEFT: return "SHIFT_LEFT";
+    case SHIFT_RIGHT: return "SHIFT_RIGHT";
+    case MUL_HIGH_SHIFT: return "MUL_HIGH_SHIFT";
+    case ARRAY_FILL: return "ARRAY_FILL";
+    case ARRAY_IOTA: return "ARRAY_IOTA";
+    case ARRAY_COPY: return "ARRAY_COPY";
+    case ARRAY_SUM: return "ARRAY_SUM";
+    case ARRAY_MIN: return "ARRAY_MIN";
+    case ARRAY_MAX: return "ARRAY_MAX";
   }
 }
\ No newline at end of file
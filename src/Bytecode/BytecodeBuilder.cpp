@@ -52,8 +52,8 @@ void BytecodeBuilder::storeInIndex(const std::string& Name) {
   Bytecode.push_back({Operation::STORE_IN_INDEX, {Name}});
 }
 
-void BytecodeBuilder::newArray() {
-  Bytecode.push_back({Operation::NEW_ARRAY, {}});
+void BytecodeBuilder::newArray(const std::string& Function, size_t Line) {
+  Bytecode.push_back({Operation::NEW_ARRAY, {Function, std::to_string(Line)}});
 }
 
 void BytecodeBuilder::print() {
@@ -10,6 +10,7 @@ class ToBytecode : public ASTVisitor {
   int LabelCtr = 0;
   std::string CurWhileConditionLabel;
   std::string CurWhileAfterLabel;
+  std::string CurFunction;
   bool IsAssignment = false;
   std::unordered_map<std::string, TypeAST::TypeKind> TypeMap;
 
@@ -45,6 +46,7 @@ class ToBytecode : public ASTVisitor {
   void visit(FunctionDeclarationAST& Node) override {
     TypeMap.clear();
     LabelCtr = 0;
+    CurFunction = Node.Ident->Value;
     std::vector<std::string> Names;
     Names.push_back(Node.Ident->Value);
     for (int i = 0; i < Node.Arguments->Idents.size(); i++) {
@@ -350,7 +352,7 @@ class ToBytecode : public ASTVisitor {
 
   void visit(ArrayInitializationAST& Node) override {
     Node.Expr->accept(*this);
-    Builder.newArray();
+    Builder.newArray(CurFunction, Node.Line);
   }
 
   void visit(GetByIndexAST& Node) override {
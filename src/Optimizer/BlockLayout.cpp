@@ -0,0 +1,243 @@
+#include "Optimizer/Passes.h"
+
+#include <set>
+
+namespace {
+
+using Code = std::vector<std::pair<Operation, std::vector<std::string>>>;
+
+Operation Inverted(Operation jump) {
+  switch (jump) {
+    case JUMP_EQ: return JUMP_NE;
+    case JUMP_NE: return JUMP_EQ;
+    case JUMP_LT: return JUMP_GE;
+    case JUMP_GE: return JUMP_LT;
+    case JUMP_LE: return JUMP_GT;
+    case JUMP_GT: return JUMP_LE;
+    default: return jump;
+  }
+}
+
+class Layout {
+ public:
+  explicit Layout(ControlFlowGraph& graph)
+      : graph(graph), labels(graph.blocks.size()), isPlaced(graph.blocks.size(), false),
+        isCold(graph.blocks.size(), true) {
+    for (size_t block = 0; block < graph.blocks.size(); ++block) {
+      int64_t begin = graph.blocks[block].begin;
+      if (begin < graph.blocks[block].end && graph.instructions[begin].operation == LABEL)
+        labels[block] = graph.instructions[begin].operands[0];
+    }
+  }
+
+  // Chains blocks along the more frequent successor, the entry stays first and FUN_END last.
+  // Cold blocks are chained the same way after all the others
+  bool Order() {
+    auto last = static_cast<int64_t>(graph.blocks.size()) - 1;
+    isPlaced[last] = true;
+    MarkHot();
+    Chain(0);
+    isPlacingCold = true;
+    Chain(NoInstruction);
+    order.push_back(last);
+
+    for (size_t it = 0; it < order.size(); ++it) {
+      if (order[it] != static_cast<int64_t>(it))
+        return true;
+    }
+    return false;
+  }
+
+  void Emit() {
+    std::vector<Code> tails(order.size());
+    for (size_t it = 0; it + 1 < order.size(); ++it)
+      tails[it] = FixTerminator(order[it], order[it + 1]);
+    std::vector<size_t> position(graph.blocks.size());
+    for (size_t it = 0; it < order.size(); ++it)
+      position[order[it]] = it;
+
+    Code code;
+    for (size_t it = 0; it < order.size(); ++it) {
+      int64_t block = order[it];
+      int64_t begin = graph.blocks[block].begin;
+      bool hasLabel = begin < graph.blocks[block].end && graph.instructions[begin].operation == LABEL;
+      if (!hasLabel && !labels[block].empty())
+        code.emplace_back(LABEL, std::vector<std::string>{labels[block]});
+      for (int64_t id = begin; id < graph.blocks[block].end; ++id) {
+        auto& instruction = graph.instructions[id];
+        if (instruction.isDeleted || dropped.count(id))
+          continue;
+        if (IsTurnedBack(id, position))
+          code.emplace_back(JUMP, std::vector<std::string>{instruction.operands[0], ExecutionProfile::UnrecordedKey});
+        else
+          code.emplace_back(instruction.operation, instruction.operands);
+      }
+      code.insert(code.end(), tails[it].begin(), tails[it].end());
+    }
+
+    for (size_t id = 0; id < graph.instructions.size(); ++id) {
+      if (!graph.instructions[id].isDeleted)
+        graph.Delete(static_cast<int64_t>(id));
+    }
+    graph.InsertBefore(0, code);
+    graph.Rebuild();
+  }
+
+ private:
+  ControlFlowGraph& graph;
+  std::vector<std::string> labels; // Per block, empty until a jump needs one
+  std::vector<bool> isPlaced;
+  std::vector<bool> isCold; // Never reached in the profiled run
+  bool isPlacingCold = false;
+  std::vector<int64_t> order;
+  std::set<int64_t> dropped; // Jumps to the block placed right after them
+
+  [[nodiscard]] int64_t Terminator(int64_t block) const {
+    for (int64_t it = graph.blocks[block].end - 1; it >= graph.blocks[block].begin; --it) {
+      if (!graph.instructions[it].isDeleted)
+        return it;
+    }
+    return NoInstruction;
+  }
+
+  // A forward JUMP the new order turns backwards: it isn't a back edge of a loop in the profile
+  [[nodiscard]] bool IsTurnedBack(int64_t id, const std::vector<size_t>& position) const {
+    auto& instruction = graph.instructions[id];
+    if (instruction.operation != JUMP || instruction.operands.size() > 1)
+      return false;
+    auto block = static_cast<int64_t>(instruction.block);
+    int64_t target = Target(id);
+    return target > block && position[target] < position[block];
+  }
+
+  [[nodiscard]] int64_t Target(int64_t jump) const {
+    auto label = graph.labels.find(graph.instructions[jump].operands[0]);
+    if (label == graph.labels.end())
+      return NoInstruction;
+    return static_cast<int64_t>(graph.instructions[label->second].block);
+  }
+
+  [[nodiscard]] bool IsFree(int64_t block) const {
+    return block != NoInstruction && !isPlaced[block] && isCold[block] == isPlacingCold;
+  }
+
+  // Blocks reachable from the entry without a branch side the profile never saw taken. Jumps missing from the
+  // profile (new labels, inlined code) keep both sides
+  void MarkHot() {
+    std::vector<int64_t> worklist = {0};
+    isCold[0] = false;
+    while (!worklist.empty()) {
+      int64_t block = worklist.back();
+      worklist.pop_back();
+      std::vector<int64_t> successors = graph.blocks[block].successors;
+      int64_t terminator = Terminator(block);
+      if (terminator != NoInstruction && ControlFlowGraph::IsJump(graph.instructions[terminator].operation)
+          && graph.instructions[terminator].operation != JUMP) {
+        ExecutionProfile::Branch branch;
+        if (graph.profile->FindBranch(graph.instructions[terminator].operands, branch)) {
+          successors.clear();
+          if (branch.taken > 0)
+            successors.push_back(Target(terminator));
+          if (branch.notTaken > 0)
+            successors.push_back(block + 1);
+        }
+      }
+      for (int64_t successor : successors) {
+        if (successor != NoInstruction && successor < static_cast<int64_t>(graph.blocks.size())
+            && isCold[successor]) {
+          isCold[successor] = false;
+          worklist.push_back(successor);
+        }
+      }
+    }
+  }
+
+  // Places a chain from the block, then chains from the first free block until none is left
+  void Chain(int64_t next) {
+    auto last = static_cast<int64_t>(graph.blocks.size()) - 1;
+    int64_t unplaced = 0;
+    while (true) {
+      while (next == NoInstruction && unplaced < last) {
+        if (IsFree(unplaced))
+          next = unplaced;
+        ++unplaced;
+      }
+      if (next == NoInstruction)
+        return;
+      isPlaced[next] = true;
+      order.push_back(next);
+      next = PreferredSuccessor(next);
+    }
+  }
+
+  [[nodiscard]] int64_t PreferredSuccessor(int64_t block) const {
+    int64_t terminator = Terminator(block);
+    int64_t fallThrough = block + 1;
+    if (terminator == NoInstruction)
+      return IsFree(fallThrough) ? fallThrough : NoInstruction;
+
+    auto& instruction = graph.instructions[terminator];
+    if (instruction.operation == RETURN || instruction.operation == FUN_END)
+      return NoInstruction;
+    if (instruction.operation == JUMP)
+      return IsFree(Target(terminator)) ? Target(terminator) : NoInstruction;
+    if (!ControlFlowGraph::IsJump(instruction.operation))
+      return IsFree(fallThrough) ? fallThrough : NoInstruction;
+
+    int64_t target = Target(terminator);
+    ExecutionProfile::Branch branch;
+    bool isTakenMore = graph.profile->FindBranch(instruction.operands, branch) && branch.taken > branch.notTaken;
+    if (isTakenMore && IsFree(target))
+      return target;
+    if (IsFree(fallThrough))
+      return fallThrough;
+    return IsFree(target) ? target : NoInstruction;
+  }
+
+  const std::string& LabelOf(int64_t block) {
+    if (labels[block].empty())
+      labels[block] = graph.NewLabel();
+    return labels[block];
+  }
+
+  // Code after the block so that control still reaches the same successors with next placed after it
+  Code FixTerminator(int64_t block, int64_t next) {
+    int64_t terminator = Terminator(block);
+    int64_t fallThrough = block + 1;
+    if (terminator != NoInstruction) {
+      auto& instruction = graph.instructions[terminator];
+      auto operation = instruction.operation;
+      if (operation == RETURN || operation == FUN_END)
+        return {};
+      if (operation == JUMP) {
+        if (Target(terminator) == next)
+          dropped.insert(terminator);
+        return {};
+      }
+      if (ControlFlowGraph::IsJump(operation) && fallThrough != next) {
+        if (Target(terminator) != next)
+          return {{JUMP, {LabelOf(fallThrough), ExecutionProfile::UnrecordedKey}}};
+        // The target comes next: jump to the old fall through on the opposite condition, still counted as the
+        // same branch
+        instruction.operation = Inverted(operation);
+        instruction.operands = ExecutionProfile::InvertedBranch(instruction.operands, LabelOf(fallThrough));
+        return {};
+      }
+    }
+    if (fallThrough == next || fallThrough >= static_cast<int64_t>(graph.blocks.size()))
+      return {};
+    return {{JUMP, {LabelOf(fallThrough), ExecutionProfile::UnrecordedKey}}};
+  }
+};
+
+}
+
+bool BlockLayout(ControlFlowGraph& graph) {
+  if (!graph.profile || graph.blocks.size() < 3)
+    return false;
+  Layout layout(graph);
+  if (!layout.Order())
+    return false;
+  layout.Emit();
+  return true;
+}
@@ -0,0 +1,197 @@
+#include "Optimizer/Optimizer.h"
+#include "Optimizer/ControlFlowGraph.h"
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Command = std::pair<Operation, std::vector<std::string>>;
+
+// Arrays have fewer cells than this (Heap::LargeObjectStride), so a bound proven against an array length is
+// below it too and i < bound + c can't wrap around for steps up to it
+constexpr int64_t MaxCheckedStep = int64_t(1) << 32;
+
+bool IsNonNegativeConstant(const Command& command) {
+  return command.first == PUSH && std::stoll(command.second[0]) >= 0;
+}
+
+// Length of an array variable: either a constant or an integer variable that keeps its value
+struct ArrayLength {
+  bool isConstant = false;
+  int64_t constant = 0;
+  std::string variable;
+  size_t definition = 0; // ARRAY_STORE of the array
+};
+
+struct Function {
+  size_t begin = 0; // FUN_BEGIN
+  size_t end = 0;   // FUN_END
+  std::map<std::string, size_t> labels;
+  std::map<std::string, std::vector<size_t>> integerStores;
+  std::map<std::string, std::vector<size_t>> arrayStores;
+  std::set<std::string> params;
+};
+
+// Arrays stored once, straight from "size; NEW_ARRAY", before any control flow of the function.
+// Such an allocation runs exactly once and precedes every later instruction.
+std::map<std::string, ArrayLength> FindArrayLengths(const std::vector<Command>& bytecode, const Function& function) {
+  std::map<std::string, ArrayLength> lengths;
+  for (auto& [name, stores] : function.arrayStores) {
+    size_t store = stores[0];
+    if (stores.size() != 1 || function.params.count(name) || store < function.begin + 3)
+      continue;
+    if (bytecode[store - 1].first != NEW_ARRAY && bytecode[store - 1].first != NEW_LOCAL_ARRAY)
+      continue;
+
+    bool hasControlFlow = false;
+    for (size_t it = function.begin + 1; it < store; ++it)
+      hasControlFlow = hasControlFlow || bytecode[it].first == LABEL
+          || ControlFlowGraph::IsJump(bytecode[it].first);
+    if (hasControlFlow)
+      continue;
+
+    auto& size = bytecode[store - 2];
+    ArrayLength length;
+    length.definition = store;
+    if (size.first == PUSH) {
+      length.isConstant = true;
+      length.constant = std::stoll(size.second[0]);
+    } else if (size.first == INTEGER_LOAD) {
+      // Any later store could change the variable, earlier ones are straight-line code
+      length.variable = size.second[0];
+      auto stores = function.integerStores.find(length.variable);
+      if (stores != function.integerStores.end() && stores->second.back() > store)
+        continue;
+    } else {
+      continue;
+    }
+    lengths[name] = length;
+  }
+  return lengths;
+}
+
+// "INTEGER_LOAD i; PUSH c; ADD; INTEGER_STORE i" with 0 <= c <= MaxCheckedStep: a larger step could wrap i around
+bool IsIncrement(const std::vector<Command>& bytecode, size_t store) {
+  const std::string& variable = bytecode[store].second[0];
+  return bytecode[store - 1].first == ADD && IsNonNegativeConstant(bytecode[store - 2])
+      && std::stoll(bytecode[store - 2].second[0]) <= MaxCheckedStep
+      && bytecode[store - 3].first == INTEGER_LOAD && bytecode[store - 3].second[0] == variable;
+}
+
+// Handles loops generated for "for (integer i = k; i < bound; i = i + c)" and the equivalent while loops:
+//   PUSH k; INTEGER_STORE i; LABEL L; <bound>; INTEGER_LOAD i; CMP; JUMP_GE exit; body; JUMP L
+// With k, c >= 0 the index stays in [0, bound) in the body until it is incremented.
+void EliminateInLoop(std::vector<Command>& bytecode,
+                     const Function& function,
+                     const std::map<std::string, ArrayLength>& lengths,
+                     size_t header,
+                     size_t backEdge) {
+  if (header < function.begin + 3 || header + 4 >= backEdge)
+    return;
+  auto& bound = bytecode[header + 1];
+  auto& index = bytecode[header + 2];
+  if ((bound.first != PUSH && bound.first != INTEGER_LOAD) || index.first != INTEGER_LOAD
+      || bytecode[header + 3].first != CMP || bytecode[header + 4].first != JUMP_GE)
+    return;
+
+  const std::string& variable = index.second[0];
+  if (bytecode[header - 1].first != INTEGER_STORE || bytecode[header - 1].second[0] != variable
+      || !IsNonNegativeConstant(bytecode[header - 2]))
+    return;
+
+  // The header must be entered only by falling through from the initialization or from the body
+  const std::string& label = bytecode[header].second[0];
+  for (size_t it = function.begin; it < function.end; ++it) {
+    if (ControlFlowGraph::IsJump(bytecode[it].first) && bytecode[it].second[0] == label
+        && (it < header || it > backEdge))
+      return;
+  }
+
+  size_t bodyBegin = header + 5;
+  size_t firstStore = backEdge;
+  for (size_t it = bodyBegin; it < backEdge; ++it) {
+    if (bytecode[it].first != INTEGER_STORE)
+      continue;
+    if (bound.first == INTEGER_LOAD && bytecode[it].second[0] == bound.second[0])
+      return;
+    if (bytecode[it].second[0] == variable) {
+      if (!IsIncrement(bytecode, it))
+        return;
+      firstStore = std::min(firstStore, it - 3);
+    }
+  }
+
+  // An inner loop jumping back over the increment would reach the accesses with an unchecked index
+  size_t safeEnd = firstStore;
+  for (size_t it = firstStore; it < backEdge; ++it) {
+    if (!ControlFlowGraph::IsJump(bytecode[it].first))
+      continue;
+    auto target = function.labels.find(bytecode[it].second[0]);
+    if (target != function.labels.end() && target->second > header && target->second < safeEnd)
+      safeEnd = target->second;
+  }
+
+  for (size_t it = bodyBegin + 1; it < safeEnd; ++it) {
+    auto& [operation, operands] = bytecode[it];
+    if (operation != LOAD_FROM_INDEX && operation != STORE_IN_INDEX)
+      continue;
+    if (bytecode[it - 1].first != INTEGER_LOAD || bytecode[it - 1].second[0] != variable)
+      continue;
+
+    auto length = lengths.find(operands[0]);
+    if (length == lengths.end() || length->second.definition > header)
+      continue;
+
+    bool isProven;
+    if (length->second.isConstant)
+      isProven = bound.first == PUSH && std::stoll(bound.second[0]) <= length->second.constant;
+    else
+      isProven = bound.first == INTEGER_LOAD && bound.second[0] == length->second.variable;
+
+    if (isProven)
+      operation = operation == LOAD_FROM_INDEX ? LOAD_FROM_INDEX_UNCHECKED : STORE_IN_INDEX_UNCHECKED;
+  }
+}
+
+}
+
+void Optimizer::boundsCheckElimination(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode) {
+  std::vector<Function> functions;
+  for (size_t it = 0; it < bytecode.size(); ++it) {
+    auto& [operation, operands] = bytecode[it];
+    if (operation == FUN_BEGIN) {
+      functions.emplace_back();
+      functions.back().begin = it;
+      for (size_t i = 2; i < operands.size(); i += 2)
+        functions.back().params.insert(operands[i]);
+    } else if (functions.empty()) {
+      continue;
+    } else if (operation == FUN_END) {
+      functions.back().end = it;
+    } else if (operation == LABEL) {
+      functions.back().labels[operands[0]] = it;
+    } else if (operation == INTEGER_STORE) {
+      functions.back().integerStores[operands[0]].push_back(it);
+    } else if (operation == ARRAY_STORE) {
+      functions.back().arrayStores[operands[0]].push_back(it);
+    }
+  }
+
+  for (auto& function : functions) {
+    auto lengths = FindArrayLengths(bytecode, function);
+    if (lengths.empty())
+      continue;
+
+    for (size_t it = function.begin; it < function.end; ++it) {
+      if (bytecode[it].first != JUMP)
+        continue;
+      auto header = function.labels.find(bytecode[it].second[0]);
+      if (header != function.labels.end() && header->second < it)
+        EliminateInLoop(bytecode, function, lengths, header->second, it);
+    }
+  }
+}
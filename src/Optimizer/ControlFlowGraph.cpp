@@ -0,0 +1,669 @@
+#include "Optimizer/ControlFlowGraph.h"
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+ControlFlowGraph::ControlFlowGraph(const std::vector<std::pair<Operation, std::vector<std::string>>>& function,
+                                   const std::map<std::string, size_t>& arities,
+                                   const std::set<std::string>& pureFunctions,
+                                   const std::set<std::string>& terminatingFunctions,
+                                   const ExecutionProfile::Function* profile)
+    : profile(profile), arities(arities), pureFunctions(pureFunctions), terminatingFunctions(terminatingFunctions) {
+  for (auto& [operation, operands] : function) {
+    instructions.emplace_back();
+    instructions.back().operation = operation;
+    instructions.back().operands = operands;
+  }
+
+  if (!instructions.empty() && instructions[0].operation == FUN_BEGIN) {
+    auto& header = instructions[0].operands;
+    for (size_t it = 1; it + 1 < header.size(); it += 2) {
+      if (header[it] == "array")
+        arrayParams.push_back(header[it + 1]);
+      else
+        integerParams.push_back(header[it + 1]);
+    }
+  }
+
+  BuildBlocks();
+  BuildStackChains();
+  BuildVariableChains();
+}
+
+bool ControlFlowGraph::IsVariableLoad(Operation operation) {
+  return operation == INTEGER_LOAD || operation == ARRAY_LOAD || operation == LOAD_FROM_INDEX
+      || operation == LOAD_FROM_INDEX_UNCHECKED || operation == STORE_IN_INDEX || operation == STORE_IN_INDEX_UNCHECKED
+      || IsBulkArrayOperation(operation);
+}
+
+bool ControlFlowGraph::IsBulkArrayOperation(Operation operation) {
+  return operation == ARRAY_FILL || operation == ARRAY_IOTA || operation == ARRAY_COPY || operation == ARRAY_SUM
+      || operation == ARRAY_MIN || operation == ARRAY_MAX;
+}
+
+bool ControlFlowGraph::IsArrayWrite(Operation operation) {
+  return operation == STORE_IN_INDEX || operation == STORE_IN_INDEX_UNCHECKED || operation == ARRAY_FILL
+      || operation == ARRAY_IOTA || operation == ARRAY_COPY;
+}
+
+bool ControlFlowGraph::IsVariableStore(Operation operation) {
+  return operation == INTEGER_STORE || operation == ARRAY_STORE;
+}
+
+bool ControlFlowGraph::IsArrayVariable(Operation operation) {
+  return operation != INTEGER_LOAD && operation != INTEGER_STORE;
+}
+
+bool ControlFlowGraph::IsJump(Operation operation) {
+  return operation == JUMP || operation == JUMP_EQ || operation == JUMP_NE || operation == JUMP_LT
+      || operation == JUMP_LE || operation == JUMP_GT || operation == JUMP_GE;
+}
+
+bool ControlFlowGraph::IsConstant(int64_t id) const {
+  return id != NoInstruction && !instructions[id].isDeleted && instructions[id].operation == PUSH;
+}
+
+int64_t ControlFlowGraph::ConstantValue(int64_t id) const {
+  return std::stoll(instructions[id].operands[0]);
+}
+
+bool ControlFlowGraph::Evaluate(Operation operation, int64_t lhs, int64_t rhs, int64_t& result) {
+  // Same wrap-around as the VM, without signed overflow in the optimizer itself
+  auto left = static_cast<uint64_t>(lhs);
+  auto right = static_cast<uint64_t>(rhs);
+  if (operation == ADD) {
+    result = static_cast<int64_t>(left + right);
+  } else if (operation == SUB) {
+    result = static_cast<int64_t>(left - right);
+  } else if (operation == MUL) {
+    result = static_cast<int64_t>(left * right);
+  } else {
+    // Division by zero is left for the VM to report
+    if (rhs == 0 || (rhs == -1 && lhs == std::numeric_limits<int64_t>::min()))
+      return false;
+    result = operation == DIV ? lhs / rhs : lhs % rhs;
+  }
+  return true;
+}
+
+std::pair<int64_t, int64_t> ControlFlowGraph::StackEffect(const Instruction& instruction) const {
+  int64_t arity = -1;
+  if (instruction.operation == FUN_CALL) {
+    auto callee = arities.find(instruction.operands[0]);
+    if (callee != arities.end())
+      arity = static_cast<int64_t>(callee->second);
+  }
+  return StackEffect(instruction.operation, arity);
+}
+
+std::pair<int64_t, int64_t> ControlFlowGraph::StackEffect(Operation operation, int64_t arity) {
+  switch (operation) {
+    case ADD: case SUB: case MUL: case DIV: case MOD: return {2, 1};
+    case PUSH: case INTEGER_LOAD: case ARRAY_LOAD: return {0, 1};
+    case LOAD_FROM_INDEX: case LOAD_FROM_INDEX_UNCHECKED: case NEW_ARRAY: case NEW_LOCAL_ARRAY: return {1, 1};
+    case SHIFT_LEFT: case SHIFT_RIGHT: case MUL_HIGH_SHIFT: return {1, 1};
+    case INTEGER_STORE: case ARRAY_STORE: case PRINT: case RETURN: return {1, 0};
+    case STORE_IN_INDEX: case STORE_IN_INDEX_UNCHECKED: case CMP: return {2, 0};
+    case ARRAY_FILL: case ARRAY_COPY: return {3, 0};
+    case ARRAY_IOTA: return {4, 0};
+    case ARRAY_SUM: case ARRAY_MIN: case ARRAY_MAX: return {3, 1};
+    case FUN_CALL: return {arity, 1};
+    default: return {0, 0};
+  }
+}
+
+void ControlFlowGraph::BuildBlocks() {
+  auto size = static_cast<int64_t>(instructions.size());
+  std::vector<bool> isLeader(size + 1, false);
+  isLeader[0] = true;
+  for (int64_t it = 0; it < size; ++it) {
+    auto operation = instructions[it].operation;
+    if (operation == LABEL) {
+      isLeader[it] = true;
+      labels[instructions[it].operands[0]] = it;
+    }
+    if (IsJump(operation) || operation == RETURN)
+      isLeader[it + 1] = true;
+  }
+
+  for (int64_t it = 0; it < size; ++it) {
+    if (isLeader[it]) {
+      if (!blocks.empty())
+        blocks.back().end = it;
+      blocks.emplace_back();
+      blocks.back().begin = it;
+    }
+    instructions[it].block = blocks.size() - 1;
+  }
+  if (!blocks.empty())
+    blocks.back().end = size;
+
+  auto blocksCount = static_cast<int64_t>(blocks.size());
+  for (int64_t block = 0; block < blocksCount; ++block) {
+    auto& last = instructions[blocks[block].end - 1];
+    bool isFallingThrough = last.operation != JUMP && last.operation != RETURN && last.operation != FUN_END;
+    if (IsJump(last.operation)) {
+      auto target = labels.find(last.operands[0]);
+      if (target != labels.end())
+        blocks[block].successors.push_back(static_cast<int64_t>(instructions[target->second].block));
+    }
+    if (isFallingThrough && block + 1 < blocksCount)
+      blocks[block].successors.push_back(block + 1);
+
+    auto& successors = blocks[block].successors;
+    std::sort(successors.begin(), successors.end());
+    successors.erase(std::unique(successors.begin(), successors.end()), successors.end());
+    for (int64_t successor : successors)
+      blocks[successor].predecessors.push_back(block);
+  }
+}
+
+void ControlFlowGraph::BuildStackChains() {
+  for (auto& block : blocks) {
+    std::vector<int64_t> stack;
+    for (int64_t it = block.begin; it < block.end; ++it) {
+      auto& instruction = instructions[it];
+      auto [pops, pushes] = StackEffect(instruction);
+      if (pops == -1) {
+        // Don't know how many values the call takes, so nothing below it can be tracked
+        stack.clear();
+      } else {
+        for (int64_t pop = 0; pop < pops; ++pop) {
+          if (stack.empty()) {
+            instruction.inputs.push_back(NoInstruction);
+            continue;
+          }
+          instruction.inputs.push_back(stack.back());
+          instructions[stack.back()].user = it;
+          stack.pop_back();
+        }
+      }
+      if (pushes > 0)
+        stack.push_back(it);
+    }
+  }
+}
+
+// Reaching definitions with a bit per store plus a bit per variable for "not stored since the entry"
+void ControlFlowGraph::BuildVariableChains() {
+  std::map<std::pair<bool, std::string>, int64_t> variableIds;
+  std::vector<std::vector<int64_t>> variableStores;
+  std::vector<int64_t> instructionVariable(instructions.size(), -1);
+  std::vector<int64_t> storeBit(instructions.size(), -1);
+  int64_t storesCount = 0;
+
+  for (size_t it = 0; it < instructions.size(); ++it) {
+    auto operation = instructions[it].operation;
+    if (!IsVariableLoad(operation) && !IsVariableStore(operation))
+      continue;
+
+    auto key = std::make_pair(IsArrayVariable(operation), instructions[it].operands[0]);
+    auto variable = variableIds.find(key);
+    if (variable == variableIds.end()) {
+      variable = variableIds.emplace(key, static_cast<int64_t>(variableStores.size())).first;
+      variableStores.emplace_back();
+    }
+    instructionVariable[it] = variable->second;
+    if (IsVariableStore(operation)) {
+      variableStores[variable->second].push_back(static_cast<int64_t>(it));
+      storeBit[it] = storesCount++;
+    }
+  }
+
+  auto variablesCount = static_cast<int64_t>(variableStores.size());
+  auto bitsCount = storesCount + variablesCount;
+  auto wordsCount = static_cast<size_t>((bitsCount + 63) / 64);
+  using Bits = std::vector<uint64_t>;
+  auto set = [](Bits& bits, int64_t bit) { bits[bit / 64] |= uint64_t(1) << (bit % 64); };
+  auto test = [](const Bits& bits, int64_t bit) { return (bits[bit / 64] >> (bit % 64)) & 1; };
+
+  // Per block: stores surviving to its end, and variables stored in it
+  std::vector<Bits> generated(blocks.size(), Bits(wordsCount, 0));
+  std::vector<Bits> killed(blocks.size(), Bits(wordsCount, 0));
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    std::map<int64_t, int64_t> lastStores;
+    for (int64_t it = blocks[block].begin; it < blocks[block].end; ++it) {
+      if (storeBit[it] != -1)
+        lastStores[instructionVariable[it]] = it;
+    }
+    for (auto [variable, store] : lastStores) {
+      for (int64_t other : variableStores[variable])
+        set(killed[block], storeBit[other]);
+      set(killed[block], storesCount + variable);
+      set(generated[block], storeBit[store]);
+    }
+  }
+
+  std::vector<Bits> in(blocks.size(), Bits(wordsCount, 0));
+  std::vector<Bits> out(blocks.size(), Bits(wordsCount, 0));
+  if (!blocks.empty()) {
+    for (int64_t variable = 0; variable < variablesCount; ++variable)
+      set(in[0], storesCount + variable);
+  }
+
+  std::deque<int64_t> worklist;
+  std::vector<bool> isQueued(blocks.size(), true);
+  for (size_t block = 0; block < blocks.size(); ++block)
+    worklist.push_back(static_cast<int64_t>(block));
+  while (!worklist.empty()) {
+    int64_t block = worklist.front();
+    worklist.pop_front();
+    isQueued[block] = false;
+
+    for (int64_t predecessor : blocks[block].predecessors) {
+      for (size_t word = 0; word < wordsCount; ++word)
+        in[block][word] |= out[predecessor][word];
+    }
+    bool isChanged = false;
+    for (size_t word = 0; word < wordsCount; ++word) {
+      uint64_t value = generated[block][word] | (in[block][word] & ~killed[block][word]);
+      isChanged = isChanged || value != out[block][word];
+      out[block][word] = value;
+    }
+    if (!isChanged)
+      continue;
+    for (int64_t successor : blocks[block].successors) {
+      if (!isQueued[successor]) {
+        isQueued[successor] = true;
+        worklist.push_back(successor);
+      }
+    }
+  }
+
+  // Loads after a store in the same block see only that store
+  std::vector<int64_t> blockStores(variablesCount, NoInstruction);
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    std::vector<int64_t> storedVariables;
+    for (int64_t it = blocks[block].begin; it < blocks[block].end; ++it) {
+      int64_t variable = instructionVariable[it];
+      if (variable == -1)
+        continue;
+
+      if (storeBit[it] != -1) {
+        blockStores[variable] = it;
+        storedVariables.push_back(variable);
+        continue;
+      }
+
+      auto& load = instructions[it];
+      if (blockStores[variable] != NoInstruction) {
+        load.definitions.push_back(blockStores[variable]);
+        instructions[blockStores[variable]].uses.push_back(it);
+        continue;
+      }
+      for (int64_t store : variableStores[variable]) {
+        if (test(in[block], storeBit[store])) {
+          load.definitions.push_back(store);
+          instructions[store].uses.push_back(it);
+        }
+      }
+      load.isReachedByEntry = test(in[block], storesCount + variable);
+    }
+    for (int64_t variable : storedVariables)
+      blockStores[variable] = NoInstruction;
+  }
+}
+
+bool ControlFlowGraph::IsPureCall(const Instruction& instruction) const {
+  if (instruction.operation != FUN_CALL || !pureFunctions.count(instruction.operands[0]))
+    return false;
+  auto arity = arities.find(instruction.operands[0]);
+  return arity != arities.end() && arity->second == instruction.inputs.size();
+}
+
+bool ControlFlowGraph::IsTrappingDivision(const Instruction& instruction) const {
+  if (!IsConstant(instruction.inputs[0]))
+    return true;
+  int64_t divisor = ConstantValue(instruction.inputs[0]);
+  return divisor == 0 || divisor == -1;
+}
+
+bool ControlFlowGraph::IsProvenInBounds(const Instruction& load) const {
+  if (!IsConstant(load.inputs[0]) || load.isReachedByEntry || load.definitions.empty())
+    return false;
+
+  int64_t index = ConstantValue(load.inputs[0]);
+  for (int64_t store : load.definitions) {
+    int64_t allocation = instructions[store].inputs[0];
+    if (allocation == NoInstruction)
+      return false;
+    auto& array = instructions[allocation];
+    if (array.operation != NEW_ARRAY && array.operation != NEW_LOCAL_ARRAY)
+      return false;
+    if (!IsConstant(array.inputs[0]) || index < 0 || index >= ConstantValue(array.inputs[0]))
+      return false;
+  }
+  return true;
+}
+
+bool ControlFlowGraph::CollectRemovableTree(int64_t root, std::vector<int64_t>& tree) const {
+  if (root == NoInstruction)
+    return false;
+
+  auto& instruction = instructions[root];
+  switch (instruction.operation) {
+    case PUSH:
+    case INTEGER_LOAD:
+    case ARRAY_LOAD:
+    case ADD:
+    case SUB:
+    case MUL:
+    case SHIFT_LEFT:
+    case SHIFT_RIGHT:
+    case MUL_HIGH_SHIFT:
+    case NEW_ARRAY:
+    case NEW_LOCAL_ARRAY:
+    case LOAD_FROM_INDEX_UNCHECKED:
+      break;
+    case DIV:
+    case MOD:
+      if (IsTrappingDivision(instruction))
+        return false;
+      break;
+    case LOAD_FROM_INDEX:
+      if (!IsProvenInBounds(instruction))
+        return false;
+      break;
+    case FUN_CALL:
+      if (!IsPureCall(instruction) || !terminatingFunctions.count(instruction.operands[0]))
+        return false;
+      break;
+    default:
+      return false;
+  }
+
+  tree.push_back(root);
+  for (int64_t input : instruction.inputs) {
+    if (!CollectRemovableTree(input, tree))
+      return false;
+  }
+  return true;
+}
+
+void ControlFlowGraph::Delete(int64_t id) {
+  auto& instruction = instructions[id];
+  instruction.isDeleted = true;
+  for (int64_t store : instruction.definitions) {
+    auto& uses = instructions[store].uses;
+    uses.erase(std::find(uses.begin(), uses.end(), id));
+  }
+  for (int64_t load : instruction.uses) {
+    auto& definitions = instructions[load].definitions;
+    definitions.erase(std::find(definitions.begin(), definitions.end(), id));
+  }
+  instruction.definitions.clear();
+  instruction.uses.clear();
+}
+
+bool ControlFlowGraph::DeleteWithInputs(int64_t id) {
+  std::vector<int64_t> tree = {id};
+  for (int64_t input : instructions[id].inputs) {
+    if (!CollectRemovableTree(input, tree))
+      return false;
+  }
+  for (int64_t instruction : tree)
+    Delete(instruction);
+  return true;
+}
+
+void ControlFlowGraph::ReplaceWithConstant(int64_t id, int64_t value) {
+  auto& instruction = instructions[id];
+  for (int64_t store : instruction.definitions) {
+    auto& uses = instructions[store].uses;
+    uses.erase(std::find(uses.begin(), uses.end(), id));
+  }
+  instruction.definitions.clear();
+  instruction.isReachedByEntry = false;
+  instruction.inputs.clear();
+  instruction.operation = PUSH;
+  instruction.operands = {std::to_string(value)};
+}
+
+// Backward: a variable is live where some path reaches a load of it before a store
+Liveness ControlFlowGraph::ComputeLiveness() const {
+  Liveness liveness;
+  std::vector<int64_t> instructionVariable(instructions.size(), -1);
+  for (size_t it = 0; it < instructions.size(); ++it) {
+    auto& instruction = instructions[it];
+    if (instruction.isDeleted || (!IsVariableLoad(instruction.operation) && !IsVariableStore(instruction.operation)))
+      continue;
+    auto key = std::make_pair(IsArrayVariable(instruction.operation), instruction.operands[0]);
+    auto variable = liveness.variables.emplace(key, liveness.variables.size()).first;
+    instructionVariable[it] = static_cast<int64_t>(variable->second);
+  }
+
+  size_t variablesCount = liveness.variables.size();
+  std::vector<std::vector<bool>> used(blocks.size(), std::vector<bool>(variablesCount, false));
+  std::vector<std::vector<bool>> defined(blocks.size(), std::vector<bool>(variablesCount, false));
+  for (size_t block = 0; block < blocks.size(); ++block) {
+    for (int64_t it = blocks[block].begin; it < blocks[block].end; ++it) {
+      int64_t variable = instructionVariable[it];
+      if (variable == -1)
+        continue;
+      if (IsVariableStore(instructions[it].operation))
+        defined[block][variable] = true;
+      else if (!defined[block][variable])
+        used[block][variable] = true;
+    }
+  }
+
+  liveness.liveIn.assign(blocks.size(), std::vector<bool>(variablesCount, false));
+  liveness.liveOut.assign(blocks.size(), std::vector<bool>(variablesCount, false));
+  std::deque<int64_t> worklist;
+  std::vector<bool> isQueued(blocks.size(), true);
+  for (size_t block = blocks.size(); block-- > 0;)
+    worklist.push_back(static_cast<int64_t>(block));
+  while (!worklist.empty()) {
+    int64_t block = worklist.front();
+    worklist.pop_front();
+    isQueued[block] = false;
+
+    auto& out = liveness.liveOut[block];
+    for (int64_t successor : blocks[block].successors) {
+      for (size_t variable = 0; variable < variablesCount; ++variable)
+        out[variable] = out[variable] || liveness.liveIn[successor][variable];
+    }
+    bool isChanged = false;
+    for (size_t variable = 0; variable < variablesCount; ++variable) {
+      bool isLive = used[block][variable] || (out[variable] && !defined[block][variable]);
+      isChanged = isChanged || isLive != liveness.liveIn[block][variable];
+      liveness.liveIn[block][variable] = isLive;
+    }
+    if (!isChanged)
+      continue;
+    for (int64_t predecessor : blocks[block].predecessors) {
+      if (!isQueued[predecessor]) {
+        isQueued[predecessor] = true;
+        worklist.push_back(predecessor);
+      }
+    }
+  }
+  return liveness;
+}
+
+std::vector<Loop> ControlFlowGraph::FindLoops() const {
+  std::vector<Loop> loops;
+  auto blocksCount = blocks.size();
+  if (blocksCount == 0)
+    return loops;
+
+  std::vector<bool> isReachable(blocksCount, false);
+  std::vector<int64_t> worklist = {0};
+  isReachable[0] = true;
+  while (!worklist.empty()) {
+    int64_t block = worklist.back();
+    worklist.pop_back();
+    for (int64_t successor : blocks[block].successors) {
+      if (!isReachable[successor]) {
+        isReachable[successor] = true;
+        worklist.push_back(successor);
+      }
+    }
+  }
+
+  // Iterative dominators, blocks are numbered in code order which is close to reverse postorder
+  std::vector<std::vector<bool>> dominators(blocksCount, std::vector<bool>(blocksCount, true));
+  dominators[0].assign(blocksCount, false);
+  dominators[0][0] = true;
+  bool isChanged = true;
+  while (isChanged) {
+    isChanged = false;
+    for (size_t block = 1; block < blocksCount; ++block) {
+      if (!isReachable[block])
+        continue;
+      std::vector<bool> dominated(blocksCount, true);
+      for (int64_t predecessor : blocks[block].predecessors) {
+        if (!isReachable[predecessor])
+          continue;
+        for (size_t other = 0; other < blocksCount; ++other)
+          dominated[other] = dominated[other] && dominators[predecessor][other];
+      }
+      dominated[block] = true;
+      if (dominated != dominators[block]) {
+        dominators[block] = std::move(dominated);
+        isChanged = true;
+      }
+    }
+  }
+
+  std::map<int64_t, Loop> headers;
+  for (size_t block = 0; block < blocksCount; ++block) {
+    if (!isReachable[block])
+      continue;
+    for (int64_t successor : blocks[block].successors) {
+      if (dominators[block][successor]) {
+        headers[successor].header = successor;
+        headers[successor].latches.push_back(static_cast<int64_t>(block));
+      }
+    }
+  }
+
+  for (auto& [header, loop] : headers) {
+    std::vector<bool> isInLoop(blocksCount, false);
+    isInLoop[header] = true;
+    worklist = loop.latches;
+    for (int64_t latch : loop.latches)
+      isInLoop[latch] = true;
+    while (!worklist.empty()) {
+      int64_t block = worklist.back();
+      worklist.pop_back();
+      for (int64_t predecessor : blocks[block].predecessors) {
+        if (isReachable[predecessor] && !isInLoop[predecessor]) {
+          isInLoop[predecessor] = true;
+          worklist.push_back(predecessor);
+        }
+      }
+    }
+    for (size_t block = 0; block < blocksCount; ++block) {
+      if (isInLoop[block])
+        loop.blocks.push_back(static_cast<int64_t>(block));
+    }
+    loops.push_back(std::move(loop));
+  }
+
+  std::stable_sort(loops.begin(), loops.end(), [](const Loop& lhs, const Loop& rhs) {
+    return lhs.blocks.size() < rhs.blocks.size();
+  });
+  return loops;
+}
+
+int64_t ControlFlowGraph::PreheaderPosition(const Loop& loop) const {
+  int64_t header = loop.header;
+  auto isInLoop = [&loop](int64_t block) {
+    return std::binary_search(loop.blocks.begin(), loop.blocks.end(), block);
+  };
+  if (header == 0 || isInLoop(header - 1))
+    return NoInstruction;
+  auto& predecessors = blocks[header].predecessors;
+  if (std::find(predecessors.begin(), predecessors.end(), header - 1) == predecessors.end())
+    return NoInstruction;
+  for (int64_t predecessor : predecessors) {
+    if (!isInLoop(predecessor) && predecessor != header - 1)
+      return NoInstruction;
+  }
+  int64_t label = blocks[header].begin;
+  return instructions[label].operation == LABEL ? label : NoInstruction;
+}
+
+bool ControlFlowGraph::MatchLoopCondition(const Loop& loop, LoopCondition& condition) const {
+  std::vector<int64_t> header;
+  for (int64_t it = blocks[loop.header].begin; it < blocks[loop.header].end; ++it) {
+    if (!instructions[it].isDeleted)
+      header.push_back(it);
+  }
+  if (header.size() != 5 || instructions[header[0]].operation != LABEL || instructions[header[3]].operation != CMP)
+    return false;
+
+  // y is on top, CMP compares y with x
+  auto& below = instructions[header[1]];
+  auto& top = instructions[header[2]];
+  auto exit = instructions[header[4]].operation;
+  bool isVariableOnTop = top.operation == INTEGER_LOAD;
+  if (isVariableOnTop && below.operation == INTEGER_LOAD && (exit == JUMP_LE || exit == JUMP_LT))
+    isVariableOnTop = false; // bound <= i, bound < i: the bound is on top
+  if (isVariableOnTop && (exit == JUMP_GE || exit == JUMP_GT))
+    condition.isInclusive = exit == JUMP_GT;
+  else if (!isVariableOnTop && (exit == JUMP_LE || exit == JUMP_LT))
+    condition.isInclusive = exit == JUMP_LT;
+  else
+    return false;
+
+  condition.label = header[0];
+  condition.load = isVariableOnTop ? header[2] : header[1];
+  condition.bound = isVariableOnTop ? header[1] : header[2];
+  condition.exit = header[4];
+  auto& variable = instructions[condition.load];
+  auto& bound = instructions[condition.bound];
+  if (variable.operation != INTEGER_LOAD)
+    return false;
+  condition.variable = variable.operands[0];
+  return bound.operation == PUSH || (bound.operation == INTEGER_LOAD && bound.operands[0] != condition.variable);
+}
+
+void ControlFlowGraph::InsertBefore(int64_t id,
+                                    const std::vector<std::pair<Operation, std::vector<std::string>>>& code) {
+  auto& insertion = insertions[id];
+  insertion.insert(insertion.end(), code.begin(), code.end());
+}
+
+std::string ControlFlowGraph::NewTemporary() {
+  if (temporariesCount == -1) {
+    temporariesCount = 0;
+    for (auto& instruction : instructions) {
+      if (instruction.operation != INTEGER_LOAD && instruction.operation != INTEGER_STORE)
+        continue;
+      auto& name = instruction.operands[0];
+      if (name.size() > 2 && name.compare(0, 2, "$t") == 0)
+        temporariesCount = std::max(temporariesCount, static_cast<int64_t>(std::stoll(name.substr(2))) + 1);
+    }
+  }
+  return "$t" + std::to_string(temporariesCount++);
+}
+
+std::string ControlFlowGraph::NewLabel() {
+  if (labelsCount == -1) {
+    labelsCount = 0;
+    for (auto& [label, id] : labels) {
+      if (label.size() > 2 && label.compare(0, 2, "$l") == 0)
+        labelsCount = std::max(labelsCount, static_cast<int64_t>(std::stoll(label.substr(2))) + 1);
+    }
+  }
+  return "$l" + std::to_string(labelsCount++);
+}
+
+void ControlFlowGraph::Rebuild() {
+  *this = ControlFlowGraph(Serialize(), arities, pureFunctions, terminatingFunctions, profile);
+}
+
+std::vector<std::pair<Operation, std::vector<std::string>>> ControlFlowGraph::Serialize() const {
+  std::vector<std::pair<Operation, std::vector<std::string>>> function;
+  for (size_t it = 0; it < instructions.size(); ++it) {
+    auto insertion = insertions.find(static_cast<int64_t>(it));
+    if (insertion != insertions.end())
+      function.insert(function.end(), insertion->second.begin(), insertion->second.end());
+    if (!instructions[it].isDeleted)
+      function.emplace_back(instructions[it].operation, instructions[it].operands);
+  }
+  return function;
+}
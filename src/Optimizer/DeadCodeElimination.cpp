@@ -0,0 +1,180 @@
+#include "Optimizer/Passes.h"
+
+#include <map>
+#include <set>
+
+bool DeadStoreElimination(ControlFlowGraph& graph) {
+  auto liveness = graph.ComputeLiveness();
+  bool isEliminated = false;
+
+  // A dead store into an array variable still releases the array the variable held before, dropping it would
+  // keep that array reachable until the function returns. Only the single store into a local is safe to drop.
+  std::map<std::string, size_t> arrayStoresCount;
+  for (auto& param : graph.arrayParams)
+    ++arrayStoresCount[param];
+  for (auto& instruction : graph.instructions) {
+    if (!instruction.isDeleted && instruction.operation == ARRAY_STORE)
+      ++arrayStoresCount[instruction.operands[0]];
+  }
+
+  for (size_t block = 0; block < graph.blocks.size(); ++block) {
+    auto live = liveness.liveOut[block];
+    for (int64_t it = graph.blocks[block].end - 1; it >= graph.blocks[block].begin; --it) {
+      auto& instruction = graph.instructions[it];
+      auto operation = instruction.operation;
+      if (instruction.isDeleted
+          || (!ControlFlowGraph::IsVariableLoad(operation) && !ControlFlowGraph::IsVariableStore(operation)))
+        continue;
+
+      size_t variable = liveness.variables.at({ControlFlowGraph::IsArrayVariable(operation), instruction.operands[0]});
+      if (ControlFlowGraph::IsVariableLoad(operation)) {
+        live[variable] = true;
+        continue;
+      }
+      // Loads feeding a deleted store go with it, so variables they read may die further up
+      bool isReleasing = operation == ARRAY_STORE && arrayStoresCount[instruction.operands[0]] > 1;
+      if (!live[variable] && !isReleasing && graph.DeleteWithInputs(it)) {
+        isEliminated = true;
+        continue;
+      }
+      live[variable] = false;
+    }
+  }
+  return isEliminated;
+}
+
+bool DeadArrayElimination(ControlFlowGraph& graph) {
+  std::set<std::string> params(graph.arrayParams.begin(), graph.arrayParams.end());
+  std::map<std::string, std::vector<int64_t>> arrayStores;
+  std::set<std::string> readArrays;
+  // Given an existing array (b = a, inlined params): their element stores write into an array read elsewhere
+  std::set<std::string> aliases;
+  std::set<std::string> elementWrites;
+  for (size_t it = 0; it < graph.instructions.size(); ++it) {
+    auto& instruction = graph.instructions[it];
+    if (instruction.isDeleted)
+      continue;
+    auto operation = instruction.operation;
+    if (operation == ARRAY_STORE) {
+      int64_t value = instruction.inputs[0];
+      auto allocation = value == NoInstruction ? ARRAY_LOAD : graph.instructions[value].operation;
+      if (allocation != NEW_ARRAY && allocation != NEW_LOCAL_ARRAY)
+        aliases.insert(instruction.operands[0]);
+    }
+    if (ControlFlowGraph::IsArrayWrite(operation))
+      elementWrites.insert(instruction.operands[0]);
+    if (operation == ARRAY_STORE || ControlFlowGraph::IsArrayWrite(operation))
+      arrayStores[instruction.operands[0]].push_back(static_cast<int64_t>(it));
+    else if (operation == ARRAY_LOAD || operation == LOAD_FROM_INDEX || operation == LOAD_FROM_INDEX_UNCHECKED
+             || ControlFlowGraph::IsBulkArrayOperation(operation))
+      readArrays.insert(instruction.operands[0]);
+  }
+
+  bool isEliminated = false;
+  std::vector<int64_t> tree;
+  for (auto& [array, stores] : arrayStores) {
+    if (readArrays.count(array) || params.count(array) || (aliases.count(array) && elementWrites.count(array)))
+      continue;
+
+    tree.clear();
+    bool isRemovable = true;
+    for (int64_t store : stores) {
+      // A checked store whose index may be out of bounds traps, the bulk writes check their range
+      auto operation = graph.instructions[store].operation;
+      if ((operation == STORE_IN_INDEX && !graph.IsProvenInBounds(graph.instructions[store]))
+          || ControlFlowGraph::IsBulkArrayOperation(operation))
+        isRemovable = false;
+      tree.push_back(store);
+      for (int64_t input : graph.instructions[store].inputs)
+        isRemovable = isRemovable && graph.CollectRemovableTree(input, tree);
+    }
+    if (!isRemovable)
+      continue;
+    for (int64_t id : tree)
+      graph.Delete(id);
+    isEliminated = true;
+  }
+  return isEliminated;
+}
+
+bool UnreachableCodeElimination(ControlFlowGraph& graph) {
+  if (graph.blocks.empty())
+    return false;
+  bool isChanged = false;
+
+  std::vector<bool> isReachable(graph.blocks.size(), false);
+  std::vector<int64_t> worklist = {0};
+  isReachable[0] = true;
+  while (!worklist.empty()) {
+    int64_t block = worklist.back();
+    worklist.pop_back();
+    for (int64_t successor : graph.blocks[block].successors) {
+      if (!isReachable[successor]) {
+        isReachable[successor] = true;
+        worklist.push_back(successor);
+      }
+    }
+  }
+
+  for (size_t block = 0; block < graph.blocks.size(); ++block) {
+    if (isReachable[block])
+      continue;
+    for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+      auto& instruction = graph.instructions[it];
+      if (!instruction.isDeleted && instruction.operation != FUN_BEGIN && instruction.operation != FUN_END) {
+        graph.Delete(it);
+        isChanged = true;
+      }
+    }
+  }
+
+  // A jump to one of the labels right after it, like the one closing an "if" without "else"
+  auto size = static_cast<int64_t>(graph.instructions.size());
+  int64_t previous = NoInstruction;
+  for (int64_t it = 0; it < size; ++it) {
+    auto& jump = graph.instructions[it];
+    if (jump.isDeleted)
+      continue;
+    int64_t comparison = previous;
+    previous = it;
+    if (!ControlFlowGraph::IsJump(jump.operation))
+      continue;
+
+    bool isJumpToNext = false;
+    for (int64_t next = it + 1; next < size && !isJumpToNext; ++next) {
+      auto& instruction = graph.instructions[next];
+      if (instruction.isDeleted)
+        continue;
+      if (instruction.operation != LABEL)
+        break;
+      isJumpToNext = instruction.operands[0] == jump.operands[0];
+    }
+    if (!isJumpToNext)
+      continue;
+
+    graph.Delete(it);
+    previous = comparison;
+    if (jump.operation != JUMP && comparison != NoInstruction && graph.instructions[comparison].operation == CMP
+        && graph.DeleteWithInputs(comparison))
+      previous = NoInstruction;
+    isChanged = true;
+  }
+
+  // Labels nobody jumps to split blocks for nothing
+  std::set<std::string> targets;
+  for (auto& instruction : graph.instructions) {
+    if (!instruction.isDeleted && ControlFlowGraph::IsJump(instruction.operation))
+      targets.insert(instruction.operands[0]);
+  }
+  for (int64_t it = 0; it < size; ++it) {
+    auto& instruction = graph.instructions[it];
+    if (!instruction.isDeleted && instruction.operation == LABEL && !targets.count(instruction.operands[0])) {
+      graph.Delete(it);
+      isChanged = true;
+    }
+  }
+
+  if (isChanged)
+    graph.Rebuild();
+  return isChanged;
+}
@@ -0,0 +1,203 @@
+#include "Optimizer/Optimizer.h"
+#include "Optimizer/ControlFlowGraph.h"
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Command = std::pair<Operation, std::vector<std::string>>;
+
+struct FunctionInfo {
+  size_t begin = 0; // FUN_BEGIN
+  size_t end = 0;   // FUN_END
+  std::vector<std::pair<std::string, std::string>> params; // (type, name)
+  std::vector<bool> paramEscapes;
+  std::set<std::string> escapingVariables;
+};
+
+// (pops, pushes) of the command, pops = -1 if the callee is unknown
+std::pair<int64_t, int64_t> StackEffect(const Command& command, const std::map<std::string, FunctionInfo>& functions) {
+  int64_t arity = -1;
+  if (command.first == FUN_CALL) {
+    auto callee = functions.find(command.second[0]);
+    if (callee != functions.end())
+      arity = static_cast<int64_t>(callee->second.params.size());
+  }
+  return ControlFlowGraph::StackEffect(command.first, arity);
+}
+
+// Finds the command that pops the value pushed by `producer` and the position of the value
+// among popped operands (0 - top of the stack). Fails if the value outlives the basic block.
+bool FindConsumer(const std::vector<Command>& bytecode,
+                  const FunctionInfo& function,
+                  const std::map<std::string, FunctionInfo>& functions,
+                  size_t producer,
+                  size_t& consumer,
+                  int64_t& position) {
+  int64_t depth = 0;
+  for (size_t it = producer + 1; it < function.end; ++it) {
+    if (bytecode[it].first == LABEL || ControlFlowGraph::IsJump(bytecode[it].first))
+      return false;
+
+    auto [pops, pushes] = StackEffect(bytecode[it], functions);
+    if (pops == -1)
+      return false;
+    if (pops > depth) {
+      consumer = it;
+      position = depth;
+      return true;
+    }
+    depth += pushes - pops;
+  }
+
+  return false;
+}
+
+// Whether an array pointer consumed by `consumer` at `position` may outlive the current frame.
+// Stores into array variables are resolved by the caller.
+bool EscapesThrough(const Command& consumer, int64_t position, const std::map<std::string, FunctionInfo>& functions) {
+  switch (consumer.first) {
+    case PRINT:
+    case CMP:
+    case ARRAY_COPY:
+      return false;
+    case FUN_CALL: {
+      auto it = functions.find(consumer.second[0]);
+      if (it == functions.end())
+        return true;
+      return it->second.paramEscapes[position];
+    }
+    default:
+      return true;
+  }
+}
+
+// Recomputes escaping variables and parameters of the function. Returns true if anything changed.
+bool AnalyzeFunction(const std::vector<Command>& bytecode,
+                     FunctionInfo& function,
+                     const std::map<std::string, FunctionInfo>& functions) {
+  std::set<std::string> escaping;
+  std::map<std::string, std::set<std::string>> flows; // v -> w for "ARRAY_LOAD v; ARRAY_STORE w"
+
+  for (size_t it = function.begin + 1; it < function.end; ++it) {
+    if (bytecode[it].first != ARRAY_LOAD)
+      continue;
+
+    const std::string& variable = bytecode[it].second[0];
+    size_t consumer;
+    int64_t position;
+    if (!FindConsumer(bytecode, function, functions, it, consumer, position)) {
+      escaping.insert(variable);
+    } else if (bytecode[consumer].first == ARRAY_STORE) {
+      flows[variable].insert(bytecode[consumer].second[0]);
+    } else if (EscapesThrough(bytecode[consumer], position, functions)) {
+      escaping.insert(variable);
+    }
+  }
+
+  bool isChanged = true;
+  while (isChanged) {
+    isChanged = false;
+    for (auto& [variable, targets] : flows) {
+      if (escaping.count(variable))
+        continue;
+      for (auto& target : targets) {
+        if (escaping.count(target)) {
+          escaping.insert(variable);
+          isChanged = true;
+          break;
+        }
+      }
+    }
+  }
+
+  std::vector<bool> paramEscapes;
+  for (auto& [type, name] : function.params)
+    paramEscapes.push_back(type != "array" || escaping.count(name));
+
+  bool isUpdated = paramEscapes != function.paramEscapes || escaping != function.escapingVariables;
+  function.paramEscapes = paramEscapes;
+  function.escapingVariables = escaping;
+  return isUpdated;
+}
+
+void MarkLocalArrays(std::vector<Command>& bytecode,
+                     const FunctionInfo& function,
+                     const std::map<std::string, FunctionInfo>& functions) {
+  std::map<std::string, size_t> labels;
+  for (size_t it = function.begin; it < function.end; ++it) {
+    if (bytecode[it].first == LABEL)
+      labels[bytecode[it].second[0]] = it;
+  }
+
+  // Arrays allocated inside a loop would pile up in the frame until RETURN
+  std::vector<int64_t> loopDepth(function.end - function.begin + 1, 0);
+  for (size_t it = function.begin; it < function.end; ++it) {
+    if (!ControlFlowGraph::IsJump(bytecode[it].first) || labels.count(bytecode[it].second[0]) == 0)
+      continue;
+    size_t target = labels[bytecode[it].second[0]];
+    if (target < it) {
+      loopDepth[target - function.begin]++;
+      loopDepth[it - function.begin + 1]--;
+    }
+  }
+
+  int64_t depth = 0;
+  for (size_t it = function.begin; it < function.end; ++it) {
+    depth += loopDepth[it - function.begin];
+    if (bytecode[it].first != NEW_ARRAY || depth > 0)
+      continue;
+
+    size_t consumer;
+    int64_t position;
+    if (!FindConsumer(bytecode, function, functions, it, consumer, position))
+      continue;
+
+    bool isEscaping;
+    if (bytecode[consumer].first == ARRAY_STORE)
+      isEscaping = function.escapingVariables.count(bytecode[consumer].second[0]) != 0;
+    else
+      isEscaping = EscapesThrough(bytecode[consumer], position, functions);
+
+    if (!isEscaping)
+      bytecode[it].first = NEW_LOCAL_ARRAY;
+  }
+}
+
+}
+
+void Optimizer::escapeAnalysis(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode) {
+  std::map<std::string, FunctionInfo> functions;
+  std::string currentFunction;
+  for (size_t it = 0; it < bytecode.size(); ++it) {
+    auto& [operation, operands] = bytecode[it];
+    if (operation == FUN_BEGIN) {
+      currentFunction = operands[0];
+      FunctionInfo info;
+      info.begin = it;
+      for (size_t i = 1; i + 1 < operands.size(); i += 2)
+        info.params.emplace_back(operands[i], operands[i + 1]);
+      info.paramEscapes = std::vector<bool>(info.params.size(), false);
+      functions[currentFunction] = info;
+    } else if (operation == FUN_END) {
+      functions[currentFunction].end = it;
+    }
+  }
+
+  // Parameters start as non-escaping and are only ever promoted, so this terminates
+  bool isChanged = true;
+  while (isChanged) {
+    isChanged = false;
+    for (auto& [name, function] : functions) {
+      if (AnalyzeFunction(bytecode, function, functions))
+        isChanged = true;
+    }
+  }
+
+  for (auto& [name, function] : functions)
+    MarkLocalArrays(bytecode, function, functions);
+}
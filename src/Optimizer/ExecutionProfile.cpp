@@ -0,0 +1,84 @@
+#include "Optimizer/ExecutionProfile.h"
+
+#include <sstream>
+#include <utility>
+
+void ExecutionProfile::Write(std::ostream& out) const {
+  for (auto& [name, function] : functions) {
+    out << "function " << name << ' ' << function.calls << '\n';
+    for (auto& [label, branch] : function.branches)
+      out << "branch " << label << ' ' << branch.taken << ' ' << branch.notTaken << '\n';
+    for (auto& [label, loop] : function.loops) {
+      if (loop.iterations > 0)
+        out << "loop " << label << ' ' << loop.entries << ' ' << loop.iterations << '\n';
+    }
+  }
+}
+
+bool ExecutionProfile::Read(std::istream& in) {
+  Function* current = nullptr;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string kind;
+    std::string name;
+    if (!(fields >> kind))
+      continue;
+    if (!(fields >> name))
+      return false;
+
+    if (kind == "function") {
+      current = &functions[name];
+      if (!(fields >> current->calls))
+        return false;
+    } else if (kind == "branch" && current) {
+      auto& branch = current->branches[name];
+      if (!(fields >> branch.taken >> branch.notTaken))
+        return false;
+    } else if (kind == "loop" && current) {
+      auto& loop = current->loops[name];
+      if (!(fields >> loop.entries >> loop.iterations))
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+const std::string& ExecutionProfile::BranchKey(const std::vector<std::string>& operands) {
+  return operands.size() > 1 ? operands[1] : operands[0];
+}
+
+bool ExecutionProfile::IsInvertedBranch(const std::vector<std::string>& operands) {
+  return operands.size() > 2 && operands[2] == "inverted";
+}
+
+std::vector<std::string> ExecutionProfile::InvertedBranch(const std::vector<std::string>& operands,
+                                                          const std::string& label) {
+  if (IsInvertedBranch(operands))
+    return {label, BranchKey(operands)};
+  return {label, BranchKey(operands), "inverted"};
+}
+
+int64_t ExecutionProfile::UnrolledIterations(const std::vector<std::string>& operands) {
+  return operands.size() > 2 ? std::stoll(operands[2]) : 0;
+}
+
+bool ExecutionProfile::IsRecordedKey(const std::string& key) {
+  return key.find('$') == std::string::npos;
+}
+
+std::string ExecutionProfile::SourceFunction(const std::string& name) {
+  return name.substr(0, name.find('$'));
+}
+
+bool ExecutionProfile::Function::FindBranch(const std::vector<std::string>& operands, Branch& branch) const {
+  auto found = branches.find(BranchKey(operands));
+  if (found == branches.end())
+    return false;
+  branch = found->second;
+  if (IsInvertedBranch(operands))
+    std::swap(branch.taken, branch.notTaken);
+  return true;
+}
@@ -0,0 +1,247 @@
+#include "Optimizer/Passes.h"
+
+#include <algorithm>
+
+namespace {
+
+using Code = std::vector<std::pair<Operation, std::vector<std::string>>>;
+
+bool IsArrayRead(Operation operation) {
+  return operation == LOAD_FROM_INDEX || operation == LOAD_FROM_INDEX_UNCHECKED;
+}
+
+bool IsArrayStore(Operation operation) {
+  return operation == STORE_IN_INDEX || operation == STORE_IN_INDEX_UNCHECKED;
+}
+
+// for (; i < bound; i = i + 1) whose body is one of the loops a bulk opcode does over [i, bound):
+//   a[i] = x;  a[i] = x +- i, i - x, i * c;  a[i] = b[i];  s = s + b[i];  if (b[i] < m) { m = b[i]; } and the like
+class Idiom {
+ public:
+  Idiom(ControlFlowGraph& graph, const Loop& loop) : graph(graph), loop(loop) {}
+
+  bool Replace() {
+    if (!Recognize())
+      return false;
+    Code code;
+    if (!MatchStore(code) && !MatchCopy(code) && !MatchSum(code) && !MatchMinMax(code))
+      return false;
+
+    // The loop ran at least once: i ends at the bound
+    code.push_back(Bound());
+    code.emplace_back(INTEGER_STORE, std::vector<std::string>{condition.variable});
+    code.emplace_back(JUMP, std::vector<std::string>{exit});
+    for (int64_t it : body)
+      graph.Delete(it);
+    for (int64_t it : tail)
+      graph.Delete(it);
+    graph.InsertBefore(tail.back(), code);
+    return true;
+  }
+
+ private:
+  ControlFlowGraph& graph;
+  const Loop& loop;
+  LoopCondition condition;
+  std::string exit;
+  std::vector<int64_t> body; // Live instructions between the header and the increment of i
+  std::vector<int64_t> tail; // The increment and the back edge
+
+  [[nodiscard]] const Instruction& At(size_t position) const {
+    return graph.instructions[body[position]];
+  }
+
+  [[nodiscard]] bool IsLoadOfVariable(size_t position) const {
+    return At(position).operation == INTEGER_LOAD && At(position).operands[0] == condition.variable;
+  }
+
+  // The body stores nothing but the target of the idiom, which is checked separately
+  [[nodiscard]] bool IsInvariant(size_t position) const {
+    return At(position).operation == PUSH || (At(position).operation == INTEGER_LOAD && !IsLoadOfVariable(position));
+  }
+
+  // Neither i nor the bound
+  [[nodiscard]] bool IsAccumulator(const std::string& variable) const {
+    auto& bound = graph.instructions[condition.bound];
+    return variable != condition.variable && (bound.operation != INTEGER_LOAD || bound.operands[0] != variable);
+  }
+
+  [[nodiscard]] std::pair<Operation, std::vector<std::string>> Copy(size_t position) const {
+    return {At(position).operation, At(position).operands};
+  }
+
+  [[nodiscard]] std::pair<Operation, std::vector<std::string>> Bound() const {
+    auto& bound = graph.instructions[condition.bound];
+    return {bound.operation, bound.operands};
+  }
+
+  void AppendRange(Code& code) const {
+    code.push_back(Bound());
+    code.emplace_back(INTEGER_LOAD, std::vector<std::string>{condition.variable});
+  }
+
+  bool Recognize() {
+    if (graph.PreheaderPosition(loop) == NoInstruction || !graph.MatchLoopCondition(loop, condition)
+        || condition.isInclusive || loop.latches.size() != 1 || loop.latches[0] != loop.blocks.back())
+      return false;
+    for (size_t it = 0; it < loop.blocks.size(); ++it) {
+      if (loop.blocks[it] != loop.header + static_cast<int64_t>(it))
+        return false;
+    }
+    auto& exitJump = graph.instructions[condition.exit];
+    auto target = graph.labels.find(exitJump.operands[0]);
+    if (target == graph.labels.end()
+        || std::binary_search(loop.blocks.begin(), loop.blocks.end(), graph.instructions[target->second].block))
+      return false;
+    exit = exitJump.operands[0];
+
+    for (int64_t it = graph.blocks[loop.header + 1].begin; it < graph.blocks[loop.blocks.back()].end; ++it) {
+      if (!graph.instructions[it].isDeleted)
+        body.push_back(it);
+    }
+    // i + 1 or 1 + i into i, then the back edge
+    if (body.size() < 5)
+      return false;
+    tail.assign(body.end() - 5, body.end());
+    body.resize(body.size() - 5);
+    auto isLoad = [this](int64_t id) {
+      return graph.instructions[id].operation == INTEGER_LOAD && graph.instructions[id].operands[0] == condition.variable;
+    };
+    auto isOne = [this](int64_t id) { return graph.IsConstant(id) && graph.ConstantValue(id) == 1; };
+    auto& store = graph.instructions[tail[3]];
+    return ((isLoad(tail[0]) && isOne(tail[1])) || (isOne(tail[0]) && isLoad(tail[1])))
+        && graph.instructions[tail[2]].operation == ADD && store.operation == INTEGER_STORE
+        && store.operands[0] == condition.variable && graph.instructions[tail[4]].operation == JUMP;
+  }
+
+  // a[i] = value, the value being invariant (ARRAY_FILL) or affine in i (ARRAY_IOTA)
+  bool MatchStore(Code& code) {
+    if ((body.size() != 3 && body.size() != 5) || !IsLoadOfVariable(body.size() - 2)
+        || !IsArrayStore(At(body.size() - 1).operation))
+      return false;
+    auto& array = At(body.size() - 1).operands;
+    Code offset;
+    Code step;
+    if (body.size() == 3) {
+      if (IsLoadOfVariable(0)) {
+        offset = {{PUSH, {"0"}}};
+        step = {{PUSH, {"1"}}};
+      } else if (IsInvariant(0)) {
+        code.push_back(Copy(0));
+        AppendRange(code);
+        code.emplace_back(ARRAY_FILL, array);
+        return true;
+      } else {
+        return false;
+      }
+    } else {
+      auto operation = At(2).operation;
+      bool isVariableFirst = IsLoadOfVariable(0) && IsInvariant(1);
+      bool isVariableSecond = IsInvariant(0) && IsLoadOfVariable(1);
+      size_t other = isVariableFirst ? 1 : 0;
+      if (!isVariableFirst && !isVariableSecond)
+        return false;
+      if (operation == ADD) {
+        offset = {Copy(other)};
+        step = {{PUSH, {"1"}}};
+      } else if (operation == SUB && isVariableSecond) {
+        offset = {Copy(other)};
+        step = {{PUSH, {"-1"}}};
+      } else if (operation == SUB) {
+        offset = {{PUSH, {"0"}}, Copy(other), {SUB, {}}};
+        step = {{PUSH, {"1"}}};
+      } else if (operation == MUL && At(other).operation == PUSH) {
+        offset = {{PUSH, {"0"}}};
+        step = {Copy(other)};
+      } else {
+        return false;
+      }
+    }
+    code.insert(code.end(), offset.begin(), offset.end());
+    code.insert(code.end(), step.begin(), step.end());
+    AppendRange(code);
+    code.emplace_back(ARRAY_IOTA, array);
+    return true;
+  }
+
+  // a[i] = b[i]
+  bool MatchCopy(Code& code) {
+    if (body.size() != 4 || !IsLoadOfVariable(0) || !IsArrayRead(At(1).operation) || !IsLoadOfVariable(2)
+        || !IsArrayStore(At(3).operation))
+      return false;
+    code.emplace_back(ARRAY_LOAD, At(1).operands);
+    AppendRange(code);
+    code.emplace_back(ARRAY_COPY, std::vector<std::string>{At(3).operands[0], At(1).operands[0]});
+    return true;
+  }
+
+  // s = s + b[i] or s = b[i] + s
+  bool MatchSum(Code& code) {
+    if (body.size() != 5 || At(3).operation != ADD || At(4).operation != INTEGER_STORE)
+      return false;
+    auto& sum = At(4).operands[0];
+    bool isSumFirst = At(0).operation == INTEGER_LOAD && At(0).operands[0] == sum;
+    size_t element = isSumFirst ? 1 : 0;
+    size_t accumulator = isSumFirst ? 0 : 2;
+    if (!IsAccumulator(sum) || !IsLoadOfVariable(element) || !IsArrayRead(At(element + 1).operation)
+        || At(accumulator).operation != INTEGER_LOAD || At(accumulator).operands[0] != sum)
+      return false;
+    code.push_back(Copy(accumulator));
+    AppendRange(code);
+    code.emplace_back(ARRAY_SUM, At(element + 1).operands);
+    code.emplace_back(INTEGER_STORE, std::vector<std::string>{sum});
+    return true;
+  }
+
+  // if (b[i] < m) { m = b[i]; } and the other comparisons of the two, then LABEL skip
+  bool MatchMinMax(Code& code) {
+    size_t size = body.size();
+    if ((size != 9 && size != 10) || At(3).operation != CMP || At(size - 1).operation != LABEL)
+      return false;
+    auto& skip = At(size - 1).operands[0];
+    if (At(4).operands.empty() || At(4).operands[0] != skip || !IsLoadOfVariable(5) || !IsArrayRead(At(6).operation)
+        || At(7).operation != INTEGER_STORE || (size == 10 && (At(8).operation != JUMP || At(8).operands[0] != skip)))
+      return false;
+    auto& array = At(6).operands[0];
+    auto& result = At(7).operands[0];
+
+    // m; b[i] or b[i]; m before CMP
+    bool isElementOnTop = At(0).operation == INTEGER_LOAD && At(0).operands[0] == result;
+    size_t element = isElementOnTop ? 1 : 0;
+    size_t accumulator = isElementOnTop ? 0 : 2;
+    if (!IsAccumulator(result) || !IsLoadOfVariable(element) || !IsArrayRead(At(element + 1).operation)
+        || At(element + 1).operands[0] != array || At(accumulator).operation != INTEGER_LOAD
+        || At(accumulator).operands[0] != result)
+      return false;
+
+    // The skip label is reached from the comparison and the assignment only
+    int64_t skipBlock = static_cast<int64_t>(graph.instructions[body.back()].block);
+    for (int64_t predecessor : graph.blocks[skipBlock].predecessors) {
+      if (!std::binary_search(loop.blocks.begin(), loop.blocks.end(), predecessor))
+        return false;
+    }
+
+    // The assignment runs when the jump isn't taken: CMP compares the top with the value below
+    auto jump = At(4).operation;
+    bool isSkippedWhenGreater = jump == JUMP_GE || jump == JUMP_GT;
+    if (!isSkippedWhenGreater && jump != JUMP_LE && jump != JUMP_LT)
+      return false;
+    bool isMinimum = isElementOnTop == isSkippedWhenGreater;
+    code.push_back(Copy(accumulator));
+    AppendRange(code);
+    code.emplace_back(isMinimum ? ARRAY_MIN : ARRAY_MAX, std::vector<std::string>{array});
+    code.emplace_back(INTEGER_STORE, std::vector<std::string>{result});
+    return true;
+  }
+};
+
+}
+
+bool IdiomRecognition(ControlFlowGraph& graph) {
+  bool isReplaced = false;
+  for (auto& loop : graph.FindLoops())
+    isReplaced = Idiom(graph, loop).Replace() || isReplaced;
+  if (isReplaced)
+    graph.Rebuild();
+  return isReplaced;
+}
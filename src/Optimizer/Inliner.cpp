@@ -0,0 +1,208 @@
+#include "Optimizer/Optimizer.h"
+#include "Optimizer/ControlFlowGraph.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Command = std::pair<Operation, std::vector<std::string>>;
+
+// Callees this small are always inlined, hot ones (called at least HotCallsCount times) up to HotCalleeSize
+constexpr size_t SmallCalleeSize = 16;
+constexpr size_t HotCalleeSize = 64;
+constexpr int64_t HotCallsCount = 1000;
+// The caller may grow by its own size, but at least by this many instructions
+constexpr size_t MinGrowthBudget = 256;
+
+bool IsVariableAccess(Operation operation) {
+  return operation == INTEGER_LOAD || operation == INTEGER_STORE || operation == ARRAY_LOAD || operation == ARRAY_STORE
+      || operation == LOAD_FROM_INDEX || operation == LOAD_FROM_INDEX_UNCHECKED || operation == STORE_IN_INDEX
+      || operation == STORE_IN_INDEX_UNCHECKED || ControlFlowGraph::IsBulkArrayOperation(operation);
+}
+
+// (pops, pushes), pops = -1 for a call of an unknown function
+std::pair<int64_t, int64_t> StackEffect(const Command& command, const ProgramInfo& program) {
+  int64_t arity = -1;
+  if (command.first == FUN_CALL) {
+    auto callee = program.arities.find(command.second[0]);
+    if (callee != program.arities.end())
+      arity = static_cast<int64_t>(callee->second);
+  }
+  return ControlFlowGraph::StackEffect(command.first, arity);
+}
+
+// A returning frame drops whatever is left on its operand stack, inlined code would leave it to the caller.
+// Only callees with nothing but the result on the stack at every RETURN can be inlined.
+bool HasCleanReturns(const std::vector<Command>& body, const ProgramInfo& program) {
+  std::map<std::string, size_t> labels;
+  for (size_t it = 0; it < body.size(); ++it) {
+    if (body[it].first == LABEL)
+      labels[body[it].second[0]] = it;
+  }
+
+  std::vector<int64_t> depths(body.size(), -1);
+  std::vector<size_t> worklist = {1};
+  depths[1] = 0;
+  auto flow = [&](size_t target, int64_t depth) {
+    if (depths[target] == -1) {
+      depths[target] = depth;
+      worklist.push_back(target);
+    }
+    return depths[target] == depth;
+  };
+
+  while (!worklist.empty()) {
+    size_t it = worklist.back();
+    worklist.pop_back();
+    auto& [operation, operands] = body[it];
+    auto [pops, pushes] = StackEffect(body[it], program);
+    if (pops == -1 || pops > depths[it])
+      return false;
+    int64_t depth = depths[it] - pops + pushes;
+
+    if (operation == RETURN) {
+      if (depths[it] != 1)
+        return false;
+      continue;
+    }
+    if (operation == FUN_END)
+      continue;
+    if (ControlFlowGraph::IsJump(operation)) {
+      auto target = labels.find(operands[0]);
+      if (target == labels.end() || !flow(target->second, depth))
+        return false;
+    }
+    if (operation != JUMP && (it + 1 >= body.size() || !flow(it + 1, depth)))
+      return false;
+  }
+  return true;
+}
+
+bool IsInlinable(const std::string& callee, const std::string& caller, const ProgramInfo& program) {
+  auto body = program.bodies.find(callee);
+  if (callee == caller || body == program.bodies.end())
+    return false;
+  auto& code = *body->second;
+  if (code.size() < 2 || code.front().first != FUN_BEGIN || code.back().first != FUN_END)
+    return false;
+
+  auto calls = program.callCounts.find(callee);
+  bool isHot = calls != program.callCounts.end() && calls->second >= HotCallsCount;
+  if (code.size() > (isHot ? HotCalleeSize : SmallCalleeSize))
+    return false;
+
+  // Recursive callees would only unroll themselves once
+  for (auto& [operation, operands] : code) {
+    if (operation == FUN_CALL && operands[0] == callee)
+      return false;
+  }
+  return HasCleanReturns(code, program);
+}
+
+// Number after the prefix of the renamed locals ("$i<n>_function$name") and labels ("$i<n>_label") already in
+// the function
+size_t FirstFreeInlineNumber(const std::vector<Command>& bytecode) {
+  size_t number = 0;
+  for (auto& [operation, operands] : bytecode) {
+    if (!IsVariableAccess(operation) && operation != LABEL)
+      continue;
+    auto& name = operands[0];
+    size_t begin = 2;
+    if (name.size() <= begin || name.compare(0, begin, "$i") != 0)
+      continue;
+    size_t end = name.find('_', begin);
+    if (end == std::string::npos || end == begin
+        || !std::all_of(name.begin() + begin, name.begin() + end, [](char c) { return std::isdigit(c); }))
+      continue;
+    number = std::max(number, std::stoul(name.substr(begin, end - begin)) + 1);
+  }
+  return number;
+}
+
+// Arguments are on the stack, the first one on top: the body starts by storing them into the renamed params.
+// Every RETURN leaves the result on the stack and jumps past the body.
+void AppendBody(std::vector<Command>& result, const std::vector<Command>& body, size_t number) {
+  // Errors in the copy name the callee, clones by the function they copy
+  std::string callee = ExecutionProfile::SourceFunction(body.front().second[0]);
+  std::string variablePrefix = "$i" + std::to_string(number) + "_" + callee + "$";
+  // The profile keys of the copy aren't the callee's branches, they aren't recorded
+  std::string labelPrefix = "$i" + std::to_string(number) + "_";
+  std::string end = labelPrefix + "end";
+
+  auto& header = body.front().second;
+  for (size_t it = 1; it + 1 < header.size(); it += 2)
+    result.emplace_back(header[it] == "array" ? ARRAY_STORE : INTEGER_STORE,
+                        std::vector<std::string>{variablePrefix + header[it + 1]});
+
+  for (size_t it = 1; it + 1 < body.size(); ++it) {
+    auto [operation, operands] = body[it];
+    if (IsVariableAccess(operation)) {
+      operands[0] = variablePrefix + operands[0];
+      // The source of a copy is named for error messages only
+      if (operation == ARRAY_COPY)
+        operands[1] = variablePrefix + operands[1];
+    } else if (operation == LABEL || ControlFlowGraph::IsJump(operation)) {
+      // The profile keys too, see ExecutionProfile::BranchKey and UnrolledIterations
+      operands[0] = labelPrefix + operands[0];
+      if (operands.size() > 1)
+        operands[1] = labelPrefix + operands[1];
+      if (operation == JUMP && operands.size() > 3)
+        operands[3] = labelPrefix + operands[3];
+    } else if (operation == NEW_LOCAL_ARRAY) {
+      // The callee's frame region is freed on its return, the caller's only on the caller's
+      operation = NEW_ARRAY;
+    } else if (operation == RETURN) {
+      operation = JUMP;
+      operands = {end};
+    }
+    result.emplace_back(operation, operands);
+  }
+  result.emplace_back(LABEL, std::vector<std::string>{end});
+}
+
+}
+
+bool Optimizer::inlineCalls(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+                            const ProgramInfo& program) {
+  if (bytecode.empty() || bytecode.front().first != FUN_BEGIN)
+    return false;
+  const std::string& caller = bytecode.front().second[0];
+
+  // Hottest callees first while the budget lasts
+  std::vector<std::pair<int64_t, size_t>> sites;
+  for (size_t it = 0; it < bytecode.size(); ++it) {
+    if (bytecode[it].first != FUN_CALL || !IsInlinable(bytecode[it].second[0], caller, program))
+      continue;
+    auto calls = program.callCounts.find(bytecode[it].second[0]);
+    sites.emplace_back(calls == program.callCounts.end() ? 0 : calls->second, it);
+  }
+  if (sites.empty())
+    return false;
+  std::stable_sort(sites.begin(), sites.end(), [](auto& lhs, auto& rhs) { return lhs.first > rhs.first; });
+
+  size_t budget = std::max(MinGrowthBudget, bytecode.size());
+  std::vector<bool> isInlined(bytecode.size(), false);
+  for (auto [calls, site] : sites) {
+    size_t size = program.bodies.at(bytecode[site].second[0])->size();
+    if (size > budget)
+      continue;
+    budget -= size;
+    isInlined[site] = true;
+  }
+
+  std::vector<Command> result;
+  size_t number = FirstFreeInlineNumber(bytecode);
+  for (size_t it = 0; it < bytecode.size(); ++it) {
+    if (isInlined[it])
+      AppendBody(result, *program.bodies.at(bytecode[it].second[0]), number++);
+    else
+      result.push_back(bytecode[it]);
+  }
+  bytecode = std::move(result);
+  return true;
+}
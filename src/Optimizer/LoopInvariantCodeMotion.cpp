@@ -0,0 +1,160 @@
+#include "Optimizer/Passes.h"
+
+#include <algorithm>
+#include <set>
+
+namespace {
+
+class LoopInvariants {
+ public:
+  LoopInvariants(ControlFlowGraph& graph, const Loop& loop)
+      : graph(graph), loop(loop), isInvariant(graph.instructions.size(), false) {}
+
+  bool Hoist() {
+    int64_t preheader = graph.PreheaderPosition(loop);
+    if (preheader == NoInstruction)
+      return false;
+    FindChanges();
+    FindInvariants();
+
+    bool isHoisted = false;
+    for (int64_t block : loop.blocks) {
+      for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+        if (IsHoistableRoot(it))
+          isHoisted = HoistTree(it, preheader) || isHoisted;
+      }
+    }
+    return isHoisted;
+  }
+
+ private:
+  ControlFlowGraph& graph;
+  const Loop& loop;
+  std::vector<bool> isInvariant;
+  std::set<std::string> storedIntegers;
+  std::set<std::string> storedArrays;
+  bool writesArrays = false;
+
+  void FindChanges() {
+    for (int64_t block : loop.blocks) {
+      for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+        auto& instruction = graph.instructions[it];
+        if (instruction.isDeleted)
+          continue;
+        auto operation = instruction.operation;
+        if (operation == INTEGER_STORE)
+          storedIntegers.insert(instruction.operands[0]);
+        else if (operation == ARRAY_STORE)
+          storedArrays.insert(instruction.operands[0]);
+        else if (ControlFlowGraph::IsArrayWrite(operation))
+          writesArrays = true;
+        // The callee may write into any array it is given or reaches
+        else if (operation == FUN_CALL && !graph.IsPureCall(instruction))
+          writesArrays = true;
+      }
+    }
+  }
+
+  // Hoisted code runs even if the loop body never does, so it must not trap. Array reads and divisions that may
+  // trap are hoisted only from the header before anything with an effect: it runs first on every entry anyway.
+  // So are pure calls, which may not terminate where they never ran before.
+  void FindInvariants() {
+    for (int64_t block : loop.blocks) {
+      bool isHeaderPrefix = block == loop.header;
+      for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+        auto& instruction = graph.instructions[it];
+        if (instruction.isDeleted)
+          continue;
+
+        bool areInputsInvariant = std::all_of(instruction.inputs.begin(), instruction.inputs.end(), [&](int64_t input) {
+          return input != NoInstruction && isInvariant[input];
+        });
+        switch (instruction.operation) {
+          case PUSH:
+            isInvariant[it] = true;
+            break;
+          case INTEGER_LOAD:
+            isInvariant[it] = !storedIntegers.count(instruction.operands[0]);
+            break;
+          case ADD:
+          case SUB:
+          case MUL:
+            isInvariant[it] = areInputsInvariant;
+            break;
+          case DIV:
+          case MOD:
+            isInvariant[it] = areInputsInvariant && (isHeaderPrefix || !graph.IsTrappingDivision(instruction));
+            break;
+          case FUN_CALL:
+            isInvariant[it] = areInputsInvariant && isHeaderPrefix && graph.IsPureCall(instruction);
+            break;
+          case LOAD_FROM_INDEX:
+          case LOAD_FROM_INDEX_UNCHECKED:
+            isInvariant[it] = areInputsInvariant && !writesArrays && !storedArrays.count(instruction.operands[0])
+                && (isHeaderPrefix || graph.IsProvenInBounds(instruction));
+            break;
+          default:
+            break;
+        }
+
+        auto operation = instruction.operation;
+        isHeaderPrefix = isHeaderPrefix && (isInvariant[it] || operation == LABEL || operation == CMP
+            || operation == INTEGER_LOAD || operation == ARRAY_LOAD || operation == ADD || operation == SUB
+            || operation == MUL);
+      }
+    }
+  }
+
+  // The largest invariant expressions that compute something, a lone constant or load isn't worth a variable
+  [[nodiscard]] bool IsHoistableRoot(int64_t id) const {
+    auto& instruction = graph.instructions[id];
+    if (instruction.isDeleted || !isInvariant[id] || instruction.operation == PUSH
+        || instruction.operation == INTEGER_LOAD)
+      return false;
+    return instruction.user == NoInstruction || !isInvariant[instruction.user];
+  }
+
+  bool HoistTree(int64_t root, int64_t preheader) {
+    std::vector<int64_t> tree;
+    std::vector<int64_t> worklist = {root};
+    while (!worklist.empty()) {
+      int64_t id = worklist.back();
+      worklist.pop_back();
+      tree.push_back(id);
+      worklist.insert(worklist.end(), graph.instructions[id].inputs.begin(), graph.instructions[id].inputs.end());
+    }
+    std::sort(tree.begin(), tree.end());
+
+    // Moved code must be the whole stretch computing the value, nothing interleaved with it
+    for (int64_t it = tree.front(), position = 0; it <= root; ++it) {
+      if (graph.instructions[it].isDeleted)
+        continue;
+      if (tree[position] != it)
+        return false;
+      ++position;
+    }
+
+    auto temporary = graph.NewTemporary();
+    std::vector<std::pair<Operation, std::vector<std::string>>> code;
+    for (int64_t id : tree) {
+      code.emplace_back(graph.instructions[id].operation, graph.instructions[id].operands);
+      graph.Delete(id);
+    }
+    code.emplace_back(INTEGER_STORE, std::vector<std::string>{temporary});
+    graph.InsertBefore(preheader, code);
+    graph.InsertBefore(root, {{INTEGER_LOAD, {temporary}}});
+    return true;
+  }
+};
+
+}
+
+bool LoopInvariantCodeMotion(ControlFlowGraph& graph) {
+  for (auto& loop : graph.FindLoops()) {
+    if (LoopInvariants(graph, loop).Hoist()) {
+      graph.Rebuild();
+      return true;
+    }
+  }
+  return false;
+}
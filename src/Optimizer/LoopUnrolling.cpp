@@ -0,0 +1,219 @@
+#include "Optimizer/Passes.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+using Code = std::vector<std::pair<Operation, std::vector<std::string>>>;
+
+// Unrolled bodies take at most this many instructions, smaller bodies are copied more times
+constexpr int64_t MaxUnrolledSize = 64;
+constexpr int64_t UnrollFactors[] = {8, 4, 2};
+
+class Unroller {
+ public:
+  Unroller(ControlFlowGraph& graph, const Loop& loop) : graph(graph), loop(loop) {}
+
+  bool Unroll() {
+    if (!Recognize())
+      return false;
+    int64_t factor = Factor();
+    return factor > 1 && Emit(factor);
+  }
+
+ private:
+  ControlFlowGraph& graph;
+  const Loop& loop;
+  LoopCondition condition;
+  int64_t body = 0;
+  std::vector<int64_t> bodyCode; // Live instructions before the back edge
+  int64_t step = 0;
+
+  [[nodiscard]] std::vector<int64_t> Live(int64_t block) const {
+    std::vector<int64_t> live;
+    for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+      if (!graph.instructions[it].isDeleted)
+        live.push_back(it);
+    }
+    return live;
+  }
+
+  [[nodiscard]] bool IsLoadOf(int64_t id, const std::string& variable) const {
+    return id != NoInstruction && graph.instructions[id].operation == INTEGER_LOAD
+        && graph.instructions[id].operands[0] == variable;
+  }
+
+  // for (; i < bound; i = i + step) with a body of one block ending with the back edge
+  bool Recognize() {
+    if (loop.blocks.size() != 2 || loop.blocks[1] != loop.header + 1 || loop.latches.size() != 1
+        || loop.latches[0] != loop.header + 1 || graph.PreheaderPosition(loop) == NoInstruction
+        || !graph.MatchLoopCondition(loop, condition))
+      return false;
+    body = loop.header + 1;
+
+    auto latch = Live(body);
+    if (latch.empty() || graph.instructions[latch.back()].operation != JUMP)
+      return false;
+    bodyCode.assign(latch.begin(), latch.end() - 1);
+    return RecognizeBody();
+  }
+
+  // Every copy must do the same as one iteration: no labels, no values left on the stack across blocks,
+  // one update of i and the bound unchanged
+  bool RecognizeBody() {
+    int64_t updates = 0;
+    for (int64_t it : bodyCode) {
+      auto& instruction = graph.instructions[it];
+      if (instruction.operation == LABEL || graph.StackEffect(instruction).first == -1
+          || std::count(instruction.inputs.begin(), instruction.inputs.end(), NoInstruction) > 0)
+        return false;
+      if (instruction.operation != INTEGER_STORE)
+        continue;
+      auto& bound = graph.instructions[condition.bound];
+      if (bound.operation == INTEGER_LOAD && instruction.operands[0] == bound.operands[0])
+        return false;
+      if (instruction.operands[0] != condition.variable)
+        continue;
+
+      auto& update = graph.instructions[instruction.inputs[0]];
+      if (update.operation != ADD)
+        return false;
+      int64_t increment = NoInstruction;
+      if (IsLoadOf(update.inputs[1], condition.variable))
+        increment = update.inputs[0];
+      else if (IsLoadOf(update.inputs[0], condition.variable))
+        increment = update.inputs[1];
+      if (increment == NoInstruction || !graph.IsConstant(increment) || graph.ConstantValue(increment) <= 0)
+        return false;
+      step = graph.ConstantValue(increment);
+      ++updates;
+    }
+    return updates == 1;
+  }
+
+  // Iterations when both the start and the bound are constants, -1 otherwise
+  [[nodiscard]] int64_t TripCount() const {
+    if (graph.instructions[condition.bound].operation != PUSH)
+      return -1;
+
+    // The only store reaching the header from outside the loop sets a constant
+    auto& load = graph.instructions[condition.load];
+    int64_t start = NoInstruction;
+    for (int64_t definition : load.definitions) {
+      if (graph.instructions[definition].block == static_cast<size_t>(body))
+        continue;
+      if (start != NoInstruction)
+        return -1;
+      start = definition;
+    }
+    if (start == NoInstruction || load.isReachedByEntry
+        || !graph.IsConstant(graph.instructions[start].inputs[0]))
+      return -1;
+
+    __int128 first = graph.ConstantValue(graph.instructions[start].inputs[0]);
+    __int128 last = graph.ConstantValue(condition.bound);
+    if (!condition.isInclusive)
+      --last;
+    if (first > last)
+      return 0;
+    return static_cast<int64_t>(std::min<__int128>((last - first) / step + 1,
+                                                   std::numeric_limits<int64_t>::max()));
+  }
+
+  // Iterations per entry in the profile, -1 without one or for loops the optimizer made. 0 if the loop never ran
+  [[nodiscard]] int64_t ProfiledTripCount() const {
+    auto& label = graph.instructions[condition.label].operands[0];
+    if (!graph.profile || !ExecutionProfile::IsRecordedKey(label))
+      return -1;
+    auto profiled = graph.profile->loops.find(label);
+    if (profiled == graph.profile->loops.end())
+      return 0;
+    return profiled->second.iterations / std::max<int64_t>(profiled->second.entries, 1);
+  }
+
+  // The largest factor that fits the size limit, leaves at least two unrolled iterations and keeps
+  // (factor - 1) * step within int64_t, preferring one dividing a known trip count so the remainder loop doesn't run
+  [[nodiscard]] int64_t Factor() const {
+    int64_t tripCount = TripCount();
+    if (tripCount == -1)
+      tripCount = ProfiledTripCount();
+    int64_t chosen = 1;
+    for (int64_t factor : UnrollFactors) {
+      if (factor * static_cast<int64_t>(bodyCode.size()) > MaxUnrolledSize || (tripCount != -1 && tripCount < 2 * factor)
+          || static_cast<__int128>(factor - 1) * step > std::numeric_limits<int64_t>::max())
+        continue;
+      if (tripCount > 0 && tripCount % factor == 0)
+        return factor;
+      chosen = std::max(chosen, factor);
+    }
+    return chosen;
+  }
+
+  // Before the loop, which is left as the remainder:
+  //   [bound < min + (factor - 1) * step: JUMP header]   the limit below would wrap around
+  //   LABEL unrolled
+  //   i < bound - (factor - 1) * step (or <=), else JUMP header
+  //   body x factor
+  //   JUMP unrolled
+  bool Emit(int64_t factor) {
+    auto& bound = graph.instructions[condition.bound];
+    auto& headerLabel = graph.instructions[condition.label].operands[0];
+    // The limit and the guard below need (factor - 1) * step as an int64_t
+    __int128 wideMargin = static_cast<__int128>(factor - 1) * step;
+    if (wideMargin > std::numeric_limits<int64_t>::max())
+      return false;
+    auto margin = static_cast<int64_t>(wideMargin);
+    int64_t minimum = std::numeric_limits<int64_t>::min();
+    Code code;
+    std::pair<Operation, std::vector<std::string>> limit;
+    if (bound.operation == PUSH) {
+      int64_t value = graph.ConstantValue(condition.bound);
+      if (value < minimum + margin)
+        return false;
+      limit = {PUSH, {std::to_string(value - margin)}};
+    } else {
+      limit = {INTEGER_LOAD, {graph.NewTemporary()}};
+      code.emplace_back(PUSH, std::vector<std::string>{std::to_string(minimum + margin)});
+      code.emplace_back(INTEGER_LOAD, bound.operands);
+      code.emplace_back(CMP, std::vector<std::string>{});
+      code.emplace_back(JUMP_LT, std::vector<std::string>{headerLabel, ExecutionProfile::UnrecordedKey});
+      code.emplace_back(INTEGER_LOAD, bound.operands);
+      code.emplace_back(PUSH, std::vector<std::string>{std::to_string(margin)});
+      code.emplace_back(SUB, std::vector<std::string>{});
+      code.emplace_back(INTEGER_STORE, limit.second);
+    }
+
+    auto unrolled = graph.NewLabel();
+    code.emplace_back(LABEL, std::vector<std::string>{unrolled});
+    code.push_back(limit);
+    code.emplace_back(INTEGER_LOAD, std::vector<std::string>{condition.variable});
+    code.emplace_back(CMP, std::vector<std::string>{});
+    code.emplace_back(condition.isInclusive ? JUMP_GT : JUMP_GE,
+                      std::vector<std::string>{headerLabel, ExecutionProfile::UnrecordedKey});
+    for (int64_t copy = 0; copy < factor; ++copy) {
+      for (int64_t it : bodyCode)
+        code.emplace_back(graph.instructions[it].operation, graph.instructions[it].operands);
+    }
+    // Counted as factor iterations of the source loop, the checks above aren't branches of the source
+    auto& exit = graph.instructions[condition.exit].operands;
+    std::vector<std::string> backEdge = {unrolled, headerLabel, std::to_string(factor),
+                                         ExecutionProfile::BranchKey(exit)};
+    if (ExecutionProfile::IsInvertedBranch(exit))
+      backEdge.emplace_back("inverted");
+    code.emplace_back(JUMP, backEdge);
+    graph.InsertBefore(condition.label, code);
+    return true;
+  }
+};
+
+}
+
+bool LoopUnrolling(ControlFlowGraph& graph) {
+  bool isUnrolled = false;
+  for (auto& loop : graph.FindLoops())
+    isUnrolled = Unroller(graph, loop).Unroll() || isUnrolled;
+  if (isUnrolled)
+    graph.Rebuild();
+  return isUnrolled;
+}
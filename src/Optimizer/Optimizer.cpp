@@ -1,329 +1,174 @@
 #include "Optimizer/Optimizer.h"
+#include "Optimizer/ControlFlowGraph.h"
+#include "Optimizer/Passes.h"
 
-#include <string>
+#include <limits>
 #include <map>
-#include <queue>
-#include <stack>
+#include <set>
+#include <string>
 #include <vector>
 
-static std::map<Operation, int> operationsStackUsage = {
-    {ADD, 2}, // +
-    {SUB, 2}, // +
-    {MUL, 2}, // +
-    {DIV, 2}, // +
-    {MOD, 2}, // +
-    {PUSH, 0},
-    {INTEGER_LOAD, 0},
-    {ARRAY_LOAD, 0},
-    {LOAD_FROM_INDEX, 1},
-    {INTEGER_STORE, 1},  // +
-    {ARRAY_STORE, 1},  // +
-    {STORE_IN_INDEX, 1},  // +
-    {NEW_ARRAY, 1},
-    {PRINT, 1},  // +
-    {FUN_BEGIN, 0},
-    {FUN_END, 0},
-    {FUN_CALL, 0},
-    {RETURN, 1}, // +
-    {LABEL, 1},
-    {JUMP, 0},
-    {CMP, 2}, // +
-    {JUMP_EQ, 0},
-    {JUMP_NE, 0},
-    {JUMP_LT, 0},
-    {JUMP_LE, 0},
-    {JUMP_GT, 0},
-    {JUMP_GE, 0}
-};
-
-bool VariableStoringElimination(
-    std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
-    std::vector<bool>& mask,
-    size_t startIndex)
-{
-  bool isEliminated = false;
-  size_t opIndex = startIndex;
-  Operation operation = bytecode[opIndex].first;
-  size_t remainingCount = 1;
-  while (remainingCount > 0) {
-    --remainingCount;
-    remainingCount += operationsStackUsage[operation];
-    if (mask[opIndex]) {
-      isEliminated = true;
-      mask[opIndex] = false;
-    }
-
-    --opIndex;
-    operation = bytecode[opIndex].first;
-  }
-
-  return isEliminated;
-}
+namespace {
 
-
-bool VariableEliminationInsideFunction(
-    std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
-    std::vector<bool>& mask) {
-  bool isEliminated = false;
-
-  std::string currentVariable;
-  std::map<std::string, bool> uselessness;
-  for (size_t opIndex = 0; opIndex < bytecode.size(); opIndex++) {
-    auto& [operation, operands] = bytecode[opIndex];
-    if (operation == INTEGER_STORE || operation == ARRAY_STORE || operation == STORE_IN_INDEX) {
-      currentVariable = operands[0];
-      if (mask[opIndex]) {
-        uselessness[currentVariable] = true;
-      }
-    }
-  }
-
-  for (auto& [variable, isUseless] : uselessness) {
-    for (size_t opIndex = 0; opIndex < bytecode.size(); opIndex++) {
-      auto& [operation, operands] = bytecode[opIndex];
-      if (operation == INTEGER_LOAD || operation == ARRAY_LOAD || operation == LOAD_FROM_INDEX) {
-        currentVariable = operands[0];
-        if ((currentVariable == variable) && mask[opIndex]) {
-          uselessness[currentVariable] = false;
-          break;
-        }
-      }
-    }
-  }
-
-  for (auto& [variable, isUseless] : uselessness) {
-    if (!uselessness[variable]) {
+// Folds arithmetic on constants. Producers precede their users, so one forward pass folds whole expressions
+bool ConstantFolding(ControlFlowGraph& graph) {
+  bool isFolded = false;
+  for (size_t it = 0; it < graph.instructions.size(); ++it) {
+    auto& instruction = graph.instructions[it];
+    auto operation = instruction.operation;
+    if (instruction.isDeleted || (operation != ADD && operation != SUB && operation != MUL
+        && operation != DIV && operation != MOD))
+      continue;
+    if (!graph.IsConstant(instruction.inputs[0]) || !graph.IsConstant(instruction.inputs[1]))
       continue;
-    }
-    for (size_t opIndex = 0; opIndex < bytecode.size(); opIndex++) {
-      auto& [operation, operands] = bytecode[opIndex];
-      if (operation == INTEGER_STORE || operation == ARRAY_STORE || operation == STORE_IN_INDEX) {
-        currentVariable = operands[0];
-        if ((currentVariable == variable) && mask[opIndex]) {
-          isEliminated = isEliminated || VariableStoringElimination(bytecode, mask, opIndex);
-        }
-      }
-    }
-  }
-
-  return isEliminated;
-}
-
-void DeadCodeElimination(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode) {
-  std::vector<bool> mask = std::vector<bool>(bytecode.size(), true);
 
-  std::string currentFunction;
-  bool isEliminated = true;
-  while (isEliminated) {
-    isEliminated = VariableEliminationInsideFunction(bytecode, mask);
-  }
+    int64_t result;
+    if (!ControlFlowGraph::Evaluate(operation, graph.ConstantValue(instruction.inputs[1]),
+                                    graph.ConstantValue(instruction.inputs[0]), result))
+      continue;
 
-  std::vector<std::pair<Operation, std::vector<std::string>>> optimizedBytecode;
-  for (size_t op_index = 0; op_index < bytecode.size(); op_index++) {
-    if (mask[op_index]) {
-      optimizedBytecode.push_back(bytecode[op_index]);
-    }
+    graph.Delete(instruction.inputs[0]);
+    graph.Delete(instruction.inputs[1]);
+    graph.ReplaceWithConstant(static_cast<int64_t>(it), result);
+    isFolded = true;
   }
-  bytecode.swap(optimizedBytecode);
+  return isFolded;
 }
 
-// {ADD, 2},
-// {SUB, 2},
-// {MUL, 2},
-// {DIV, 2},
-// {MOD, 2},
-// {PUSH, 0},
-
+}
 
-int64_t Calculating(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
-                    std::vector<bool>& mask,
-                    size_t topIndex,
-                    size_t bottomIndex) {
-  std::stack<int64_t> stack;
-  size_t opIndex = topIndex;
-  int64_t lhs;
-  int64_t rhs;
-  while (opIndex < bottomIndex) {
-    auto& [operation, operands] = bytecode[opIndex];
-    mask[opIndex] = false;
-    switch (operation) {
-      case PUSH:
-        stack.push(std::stoll(operands[0]));
-        break;
-      case ADD:
-        rhs = stack.top();
-        stack.pop();
-        lhs = stack.top();
-        stack.pop();
-        stack.push(lhs + rhs);
-        break;
-      case SUB:
-        rhs = stack.top();
-        stack.pop();
-        lhs = stack.top();
-        stack.pop();
-        stack.push(lhs - rhs);
-        break;
-      case MUL:
-        rhs = stack.top();
-        stack.pop();
-        lhs = stack.top();
-        stack.pop();
-        stack.push(lhs * rhs);
-        break;
-      case DIV:
-        rhs = stack.top();
-        stack.pop();
-        lhs = stack.top();
-        stack.pop();
-        stack.push(lhs / rhs);
-        break;
-      case MOD:
-        rhs = stack.top();
-        stack.pop();
-        lhs = stack.top();
-        stack.pop();
-        stack.push(lhs % rhs);
-        break;
-    }
-    ++opIndex;
+namespace {
+
+// Calls or loop iterations in the profile after which a function is worth optimizing before it runs,
+// the runtime tier optimizes functions called this many times too
+constexpr int64_t HotProfileCount = 1000;
+
+bool IsHot(const ExecutionProfile& profile, const std::string& name) {
+  auto function = profile.functions.find(name);
+  if (function == profile.functions.end())
+    return false;
+  if (function->second.calls >= HotProfileCount)
+    return true;
+  for (auto& [label, loop] : function->second.loops) {
+    if (loop.iterations >= HotProfileCount)
+      return true;
   }
-  return stack.top();
+  return false;
 }
 
-bool checkFolding(
-    std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
-    size_t topIndex,
-    size_t bottomIndex)
-{
-  Operation operation;
-  for (size_t opIndex = topIndex; opIndex < bottomIndex; opIndex++) {
-    operation = bytecode[opIndex].first;
-    if (!(operation == ADD || operation == SUB || operation == MUL
-        || operation == DIV || operation == MOD || operation == PUSH)) {
-      return false;
-    }
+void RunPasses(ControlFlowGraph& graph, const ProgramInfo& program) {
+  bool isChanged = true;
+  while (isChanged) {
+    isChanged = SparseConditionalConstantPropagation(graph);
+    isChanged = ConstantFolding(graph) || isChanged;
+    isChanged = PureCallEvaluation(graph, program) || isChanged;
+    isChanged = RecursionToLoop(graph) || isChanged;
+    isChanged = IdiomRecognition(graph) || isChanged;
+    isChanged = DeadStoreElimination(graph) || isChanged;
+    isChanged = DeadArrayElimination(graph) || isChanged;
+    isChanged = UnreachableCodeElimination(graph) || isChanged;
+    isChanged = LoopInvariantCodeMotion(graph) || isChanged;
+    isChanged = InductionVariableStrengthReduction(graph) || isChanged;
+    isChanged = CommonSubexpressionElimination(graph) || isChanged;
   }
-
-  return true;
 }
 
-bool Folding(
-    std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
-    std::vector<bool>& mask,
-    size_t startIndex)
-{
-  bool toFold = false;
-  size_t opIndex;
-  size_t bottomIndex = startIndex;
-  Operation operation = bytecode[startIndex].first;
-  size_t remainingCount;
-  int64_t result;
+}
 
-  size_t rounds = 1;
-  if (operation == CMP) {
-    rounds = 2;
+void Optimizer::optimize(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+                         const ProgramInfo& program, bool isInliningEnabled) {
+  const ExecutionProfile::Function* profile = nullptr;
+  if (!bytecode.empty() && bytecode.front().first == FUN_BEGIN) {
+    auto function = program.profile.functions.find(ExecutionProfile::SourceFunction(bytecode.front().second[0]));
+    if (function != program.profile.functions.end())
+      profile = &function->second;
   }
-  for (size_t i = 0; i < rounds; ++i) {
-    opIndex = bottomIndex;
-    remainingCount = 1;
-    while (remainingCount > 0) {
-      --remainingCount;
-      --opIndex;
-      operation = bytecode[opIndex].first;
-      remainingCount += operationsStackUsage[operation];
-    }
 
-    if (checkFolding(bytecode, opIndex, bottomIndex)) {
-      toFold = true;
-      result = Calculating(bytecode, mask, opIndex, bottomIndex);
-      mask[bottomIndex - 1] = true;
-      bytecode[bottomIndex - 1] = std::make_pair(PUSH, std::vector<std::string>{std::to_string(result)});
-    }
+  ControlFlowGraph graph(bytecode, program.arities, program.pureFunctions, program.terminatingFunctions, profile);
+  RunPasses(graph, program);
 
-    bottomIndex = opIndex;
+  // Inlining after the first round inlines pure calls already moved out of loops, the second round
+  // folds the inlined bodies into their call sites
+  bytecode = graph.Serialize();
+  if (isInliningEnabled && inlineCalls(bytecode, program)) {
+    graph = ControlFlowGraph(bytecode, program.arities, program.pureFunctions, program.terminatingFunctions, profile);
+    RunPasses(graph, program);
   }
-  return toFold;
+  // Once, the remainder loops would match again
+  if (LoopUnrolling(graph))
+    RunPasses(graph, program);
+  BlockLayout(graph);
+  StrengthReduction(graph);
+  bytecode = graph.Serialize();
 }
 
-
-bool ConstantFolding(
-    std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode) {
-  std::vector<bool> mask = std::vector<bool>(bytecode.size(), true);
-  bool isFolded = false;
-
-  std::string currentVariable;
-  std::map<std::string, bool> uselessness;
-  for (size_t opIndex = 0; opIndex < bytecode.size(); opIndex++) {
-    auto& [operation, operands] = bytecode[opIndex];
-    if (operation == INTEGER_STORE || operation == ARRAY_STORE || operation == STORE_IN_INDEX
-        || operation == PRINT || operation == RETURN || operation == CMP) {
-      isFolded = Folding(bytecode, mask, opIndex);
+void Optimizer::optimizeProgram(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+                                OptimizationLevel level, const ExecutionProfile& profile) {
+  if (level == NO_OPTIMIZATION && profile.functions.empty())
+    return;
+
+  using Function = std::vector<std::pair<Operation, std::vector<std::string>>>;
+  std::vector<std::string> order;
+  std::map<std::string, Function> functions;
+  std::string current;
+  for (auto& command : bytecode) {
+    if (command.first == FUN_BEGIN) {
+      current = command.second[0];
+      order.push_back(current);
     }
+    functions[current].push_back(command);
   }
 
-  std::vector<std::pair<Operation, std::vector<std::string>>> optimizedBytecode;
-  for (size_t op_index = 0; op_index < bytecode.size(); op_index++) {
-    if (mask[op_index]) {
-      optimizedBytecode.push_back(bytecode[op_index]);
+  ProgramInfo program;
+  program.pureFunctions = findPureFunctions(bytecode);
+  program.terminatingFunctions = findTerminatingFunctions(bytecode, program.pureFunctions);
+  program.profile = profile;
+  for (auto& [name, function] : profile.functions)
+    program.callCounts[name] = function.calls;
+  for (auto& [name, function] : functions) {
+    if (!function.empty() && function.front().first == FUN_BEGIN) {
+      program.arities[name] = function.front().second.size() / 2;
+      program.bodies[name] = &function;
     }
   }
-  bytecode.swap(optimizedBytecode);
 
-  return isFolded;
-}
-
-void ConstantPropagation(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode) {
-  // name -> (isUsed, value)
-  std::map<std::string, std::pair<bool, std::string>> declaredIntegers;
-
-  // Find constant variables
-  for (int64_t it = 0; it < bytecode.size() - 1; ++it) {
-    if (bytecode[it].first == PUSH && bytecode[it + 1].first == INTEGER_STORE) {
-      std::string name = bytecode[it + 1].second[0];
-      std::string value = bytecode[it].second[0];
-      declaredIntegers[name] = {false, value};
-      it++;
-    } else if (bytecode[it].first == INTEGER_STORE) {
-      std::string name = bytecode[it].second[0];
-      if (declaredIntegers.find(name) != declaredIntegers.end())
-        declaredIntegers[name].first = true;
-    }
-  }
-
-  // Delete variable usage
-  std::vector<std::pair<Operation, std::vector<std::string>>> optimizedBytecode;
-  for (int64_t it = 0; it < bytecode.size() - 1; ++it) {
-    if (bytecode[it].first == PUSH && bytecode[it + 1].first == INTEGER_STORE) {
-      std::string name = bytecode[it + 1].second[0];
-
-      if (declaredIntegers.find(name) != declaredIntegers.end() && !declaredIntegers[name].first) {
-        it++;
-        continue;
-      }
-    }
-
-    if (bytecode[it].first == INTEGER_LOAD) {
-      std::string name = bytecode[it].second[0];
-      if (declaredIntegers.find(name) != declaredIntegers.end() && !declaredIntegers[name].first) {
-        std::string value = declaredIntegers[name].second;
-        optimizedBytecode.push_back({PUSH, {value}});
+  // Callees first (post-order over the call graph), so the inliner copies optimized bodies
+  std::vector<std::string> postOrder;
+  std::set<std::string> isVisited;
+  std::vector<std::pair<std::string, size_t>> stack;
+  for (auto& root : order) {
+    if (!isVisited.insert(root).second)
+      continue;
+    stack.emplace_back(root, 0);
+    while (!stack.empty()) {
+      auto& [name, position] = stack.back();
+      auto& function = functions[name];
+      while (position < function.size() && function[position].first != FUN_CALL)
+        ++position;
+      if (position == function.size()) {
+        postOrder.push_back(name);
+        stack.pop_back();
         continue;
       }
+      auto& callee = function[position++].second[0];
+      if (program.bodies.count(callee) && isVisited.insert(callee).second)
+        stack.emplace_back(callee, 0);
     }
+  }
 
-    optimizedBytecode.push_back(bytecode[it]);
+  for (auto& name : postOrder) {
+    if (level != NO_OPTIMIZATION)
+      optimize(functions[name], program, level == FULL_OPTIMIZATION);
+    else if (IsHot(profile, name))
+      optimize(functions[name], program);
   }
-  optimizedBytecode.push_back(bytecode.back());
-  bytecode.swap(optimizedBytecode);
-}
 
-void Optimizer::optimize(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode) {
-  std::vector<std::pair<Operation, std::vector<std::string>>> oldByteCode = bytecode;
-  do {
-    oldByteCode = bytecode;
-    DeadCodeElimination(bytecode);
-    ConstantPropagation(bytecode);
-    ConstantFolding(bytecode);
-  } while (oldByteCode != bytecode);
+  // Code outside functions (if any) keeps its place before them
+  Function result = std::move(functions[""]);
+  for (auto& name : order)
+    result.insert(result.end(), functions[name].begin(), functions[name].end());
+  bytecode = std::move(result);
+
+  if (level == FULL_OPTIMIZATION)
+    specializeFunctions(bytecode, program);
 }
@@ -0,0 +1,205 @@
+#include "Optimizer/Passes.h"
+
+#include <map>
+
+namespace {
+
+using Code = std::vector<std::pair<Operation, std::vector<std::string>>>;
+
+// Instructions one call site may run at compile time, nested calls included
+constexpr int64_t EvaluationFuel = 100000;
+constexpr size_t MaxCallDepth = 64;
+
+// Runs integer code the way the VM does. Gives up on anything else: arrays, output, traps,
+// unknown functions, running out of fuel
+class Interpreter {
+ public:
+  explicit Interpreter(const ProgramInfo& program) : program(program) {}
+
+  bool Call(const std::string& name, const std::vector<int64_t>& arguments, int64_t& result, size_t depth = 0) {
+    auto body = program.bodies.find(name);
+    if (body == program.bodies.end() || depth > MaxCallDepth)
+      return false;
+    auto& code = *body->second;
+    if (code.empty() || code.front().first != FUN_BEGIN)
+      return false;
+
+    std::map<std::string, int64_t> variables;
+    auto& header = code.front().second;
+    if (header.size() != 2 * arguments.size() + 1)
+      return false;
+    for (size_t param = 0; param < arguments.size(); ++param) {
+      if (header[2 * param + 1] != "integer")
+        return false;
+      variables[header[2 * param + 2]] = arguments[param];
+    }
+
+    auto& labels = Labels(name, code);
+    std::vector<int64_t> stack;
+    auto pop = [&stack](int64_t& value) {
+      if (stack.empty())
+        return false;
+      value = stack.back();
+      stack.pop_back();
+      return true;
+    };
+    int64_t lhs = 0;
+    int64_t rhs = 0;
+
+    for (size_t it = 1; it < code.size(); ++it) {
+      if (--fuel < 0)
+        return false;
+      auto& [operation, operands] = code[it];
+      int64_t first;
+      int64_t second;
+      switch (operation) {
+        case PUSH:
+          stack.push_back(std::stoll(operands[0]));
+          break;
+        case INTEGER_LOAD: {
+          auto variable = variables.find(operands[0]);
+          if (variable == variables.end())
+            return false;
+          stack.push_back(variable->second);
+          break;
+        }
+        case INTEGER_STORE:
+          if (!pop(first))
+            return false;
+          variables[operands[0]] = first;
+          break;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case MOD:
+          if (!pop(first) || !pop(second) || !ControlFlowGraph::Evaluate(operation, second, first, first))
+            return false;
+          stack.push_back(first);
+          break;
+        case SHIFT_LEFT:
+        case SHIFT_RIGHT:
+        case MUL_HIGH_SHIFT:
+          if (!pop(first))
+            return false;
+          stack.push_back(Lowered(operation, operands, first));
+          break;
+        case CMP:
+          if (!pop(lhs) || !pop(rhs))
+            return false;
+          break;
+        case JUMP:
+        case JUMP_EQ:
+        case JUMP_NE:
+        case JUMP_LT:
+        case JUMP_LE:
+        case JUMP_GT:
+        case JUMP_GE: {
+          if (!IsTaken(operation, lhs, rhs))
+            break;
+          auto label = labels.find(operands[0]);
+          if (label == labels.end())
+            return false;
+          it = label->second;
+          break;
+        }
+        case LABEL:
+          break;
+        case FUN_CALL: {
+          auto arity = program.arities.find(operands[0]);
+          if (arity == program.arities.end())
+            return false;
+          // The first argument is on top
+          std::vector<int64_t> calleeArguments(arity->second);
+          for (auto& argument : calleeArguments) {
+            if (!pop(argument))
+              return false;
+          }
+          if (!Call(operands[0], calleeArguments, first, depth + 1))
+            return false;
+          stack.push_back(first);
+          break;
+        }
+        case RETURN:
+          return pop(result);
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+ private:
+  const ProgramInfo& program;
+  int64_t fuel = EvaluationFuel;
+  std::map<std::string, std::map<std::string, size_t>> labelsByFunction;
+
+  const std::map<std::string, size_t>& Labels(const std::string& name, const Code& code) {
+    auto function = labelsByFunction.find(name);
+    if (function != labelsByFunction.end())
+      return function->second;
+    auto& labels = labelsByFunction[name];
+    for (size_t it = 0; it < code.size(); ++it) {
+      if (code[it].first == LABEL)
+        labels[code[it].second[0]] = it;
+    }
+    return labels;
+  }
+
+  static bool IsTaken(Operation jump, int64_t lhs, int64_t rhs) {
+    switch (jump) {
+      case JUMP: return true;
+      case JUMP_EQ: return lhs == rhs;
+      case JUMP_NE: return lhs != rhs;
+      case JUMP_LT: return lhs < rhs;
+      case JUMP_LE: return lhs <= rhs;
+      case JUMP_GT: return lhs > rhs;
+      case JUMP_GE: return lhs >= rhs;
+      default: return false;
+    }
+  }
+
+  // Same as the VM's handlers of the opcodes StrengthReduction emits
+  static int64_t Lowered(Operation operation, const std::vector<std::string>& operands, int64_t value) {
+    if (operation == SHIFT_LEFT)
+      return static_cast<int64_t>(static_cast<uint64_t>(value) << std::stoll(operands[0]));
+    if (operation == SHIFT_RIGHT) {
+      int64_t shift = std::stoll(operands[0]);
+      return (value + ((value >> 63) & ((int64_t(1) << shift) - 1))) >> shift;
+    }
+    int64_t multiplier = std::stoll(operands[0]);
+    auto quotient = static_cast<int64_t>((static_cast<__int128>(multiplier) * value) >> 64);
+    if (multiplier < 0)
+      quotient += value;
+    quotient >>= std::stoll(operands[1]);
+    return quotient + static_cast<int64_t>(static_cast<uint64_t>(quotient) >> 63);
+  }
+};
+
+}
+
+bool PureCallEvaluation(ControlFlowGraph& graph, const ProgramInfo& program) {
+  bool isEvaluated = false;
+  for (size_t it = 0; it < graph.instructions.size(); ++it) {
+    auto& instruction = graph.instructions[it];
+    if (instruction.isDeleted || instruction.operation != FUN_CALL || !graph.IsPureCall(instruction))
+      continue;
+
+    std::vector<int64_t> arguments;
+    for (int64_t input : instruction.inputs) {
+      if (!graph.IsConstant(input))
+        break;
+      arguments.push_back(graph.ConstantValue(input));
+    }
+    int64_t result;
+    if (arguments.size() != instruction.inputs.size()
+        || !Interpreter(program).Call(instruction.operands[0], arguments, result))
+      continue;
+
+    for (int64_t input : instruction.inputs)
+      graph.Delete(input);
+    graph.ReplaceWithConstant(static_cast<int64_t>(it), result);
+    isEvaluated = true;
+  }
+  return isEvaluated;
+}
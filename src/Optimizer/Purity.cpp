@@ -0,0 +1,138 @@
+#include "Optimizer/Optimizer.h"
+#include "Optimizer/ControlFlowGraph.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct FunctionEffects {
+  bool hasEffects = false;
+  std::set<std::string> callees;
+};
+
+struct FunctionShape {
+  bool hasLoop = false;
+  std::set<std::string> callees;
+};
+
+bool IsConstantDivisor(const std::pair<Operation, std::vector<std::string>>& command) {
+  if (command.first != PUSH)
+    return false;
+  int64_t divisor = std::stoll(command.second[0]);
+  return divisor != 0 && divisor != -1;
+}
+
+}
+
+std::set<std::string> Optimizer::findPureFunctions(
+    const std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode) {
+  std::map<std::string, FunctionEffects> functions;
+  FunctionEffects* current = nullptr;
+  for (size_t it = 0; it < bytecode.size(); ++it) {
+    auto& [operation, operands] = bytecode[it];
+    switch (operation) {
+      case FUN_BEGIN:
+        current = &functions[operands[0]];
+        for (size_t param = 1; param < operands.size(); param += 2)
+          current->hasEffects = current->hasEffects || operands[param] == "array";
+        break;
+      case FUN_CALL:
+        if (current)
+          current->callees.insert(operands[0]);
+        break;
+      case DIV:
+      case MOD:
+        if (current && (it == 0 || !IsConstantDivisor(bytecode[it - 1])))
+          current->hasEffects = true;
+        break;
+      case PRINT:
+      case ARRAY_LOAD:
+      case ARRAY_STORE:
+      case LOAD_FROM_INDEX:
+      case LOAD_FROM_INDEX_UNCHECKED:
+      case STORE_IN_INDEX:
+      case STORE_IN_INDEX_UNCHECKED:
+      case ARRAY_FILL:
+      case ARRAY_IOTA:
+      case ARRAY_COPY:
+      case ARRAY_SUM:
+      case ARRAY_MIN:
+      case ARRAY_MAX:
+      case NEW_ARRAY:
+      case NEW_LOCAL_ARRAY:
+        if (current)
+          current->hasEffects = true;
+        break;
+      default:
+        break;
+    }
+  }
+
+  std::set<std::string> pureFunctions;
+  for (auto& [name, effects] : functions) {
+    if (!effects.hasEffects)
+      pureFunctions.insert(name);
+  }
+
+  // A call to an impure or unknown function makes the caller impure too
+  bool isChanged = true;
+  while (isChanged) {
+    isChanged = false;
+    for (auto& [name, effects] : functions) {
+      if (!pureFunctions.count(name))
+        continue;
+      for (auto& callee : effects.callees) {
+        if (!pureFunctions.count(callee)) {
+          pureFunctions.erase(name);
+          isChanged = true;
+          break;
+        }
+      }
+    }
+  }
+  return pureFunctions;
+}
+
+std::set<std::string> Optimizer::findTerminatingFunctions(
+    const std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+    const std::set<std::string>& pureFunctions) {
+  std::map<std::string, FunctionShape> functions;
+  std::set<std::string> labels; // Of the current function, a jump to one of them is a back edge
+  FunctionShape* current = nullptr;
+  for (auto& [operation, operands] : bytecode) {
+    if (operation == FUN_BEGIN) {
+      current = &functions[operands[0]];
+      labels.clear();
+    } else if (!current) {
+      continue;
+    } else if (operation == FUN_CALL) {
+      current->callees.insert(operands[0]);
+    } else if (operation == LABEL) {
+      labels.insert(operands[0]);
+    } else if (ControlFlowGraph::IsJump(operation) && labels.count(operands[0])) {
+      current->hasLoop = true;
+    }
+  }
+
+  // Callees first: a function joins once all its callees have, so recursive ones never do
+  std::set<std::string> terminatingFunctions;
+  bool isChanged = true;
+  while (isChanged) {
+    isChanged = false;
+    for (auto& [name, function] : functions) {
+      if (terminatingFunctions.count(name) || !pureFunctions.count(name) || function.hasLoop)
+        continue;
+      bool areCalleesTerminating = true;
+      for (auto& callee : function.callees)
+        areCalleesTerminating = areCalleesTerminating && terminatingFunctions.count(callee);
+      if (areCalleesTerminating) {
+        terminatingFunctions.insert(name);
+        isChanged = true;
+      }
+    }
+  }
+  return terminatingFunctions;
+}
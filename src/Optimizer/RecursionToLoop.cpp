@@ -0,0 +1,143 @@
+#include "Optimizer/Passes.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace {
+
+using Code = std::vector<std::pair<Operation, std::vector<std::string>>>;
+
+// Self-call whose result is returned as is (a tail call) or combined with a value computed before it
+struct RecursiveCall {
+  int64_t call = 0;
+  int64_t combination = NoInstruction; // ADD or MUL of the result
+  int64_t ret = 0;
+};
+
+int64_t NextLive(const ControlFlowGraph& graph, int64_t id) {
+  for (int64_t it = id + 1; it < static_cast<int64_t>(graph.instructions.size()); ++it) {
+    if (!graph.instructions[it].isDeleted)
+      return it;
+  }
+  return NoInstruction;
+}
+
+// Operand stack depth before every instruction, -1 where it isn't known or differs between paths
+std::vector<int64_t> StackDepths(const ControlFlowGraph& graph) {
+  std::vector<int64_t> depths(graph.instructions.size(), -1);
+  std::vector<int64_t> entries(graph.blocks.size(), -1);
+  std::vector<bool> isConflicting(graph.blocks.size(), false);
+  std::deque<int64_t> worklist = {0};
+  entries[0] = 0;
+  while (!worklist.empty()) {
+    int64_t block = worklist.front();
+    worklist.pop_front();
+    int64_t depth = isConflicting[block] ? -1 : entries[block];
+    for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+      auto& instruction = graph.instructions[it];
+      if (instruction.isDeleted)
+        continue;
+      depths[it] = depth;
+      auto [pops, pushes] = graph.StackEffect(instruction);
+      depth = depth == -1 || pops == -1 || pops > depth ? -1 : depth - pops + pushes;
+    }
+    for (int64_t successor : graph.blocks[block].successors) {
+      if (entries[successor] == -1 && !isConflicting[successor]) {
+        entries[successor] = depth;
+        isConflicting[successor] = depth == -1;
+        worklist.push_back(successor);
+      } else if (entries[successor] != depth && !isConflicting[successor]) {
+        isConflicting[successor] = true;
+        worklist.push_back(successor);
+      }
+    }
+  }
+  return depths;
+}
+
+}
+
+bool RecursionToLoop(ControlFlowGraph& graph) {
+  if (graph.instructions.empty() || graph.instructions[0].operation != FUN_BEGIN || !graph.arrayParams.empty())
+    return false;
+  const std::string name = graph.instructions[0].operands[0];
+  auto arity = static_cast<int64_t>(graph.integerParams.size());
+
+  std::vector<RecursiveCall> calls;
+  std::vector<int64_t> returns;
+  Operation combination = JUMP; // None yet
+  auto depths = StackDepths(graph);
+  for (size_t it = 0; it < graph.instructions.size(); ++it) {
+    auto& instruction = graph.instructions[it];
+    if (instruction.isDeleted)
+      continue;
+    if (instruction.operation == RETURN)
+      returns.push_back(static_cast<int64_t>(it));
+    if (instruction.operation != FUN_CALL || instruction.operands[0] != name)
+      continue;
+
+    // call; [ADD | MUL;] RETURN, with nothing on the stack but the arguments and the other operand
+    RecursiveCall call{static_cast<int64_t>(it)};
+    int64_t next = NextLive(graph, call.call);
+    if (next == NoInstruction || instruction.user != next)
+      return false;
+    auto operation = graph.instructions[next].operation;
+    if (operation == ADD || operation == MUL) {
+      auto& inputs = graph.instructions[next].inputs;
+      bool isOtherKnown = std::count(inputs.begin(), inputs.end(), NoInstruction) == 0;
+      if (!isOtherKnown || (combination != JUMP && combination != operation))
+        return false;
+      combination = operation;
+      call.combination = next;
+      next = NextLive(graph, next);
+      if (next == NoInstruction || graph.instructions[call.combination].user != next)
+        return false;
+    }
+    int64_t stackDepth = arity + (call.combination == NoInstruction ? 0 : 1);
+    if (graph.instructions[next].operation != RETURN || depths[call.call] != stackDepth)
+      return false;
+    call.ret = next;
+    calls.push_back(call);
+  }
+  if (calls.empty())
+    return false;
+
+  // The result is the combination of every level's operand with the base case: accumulated on the way down,
+  // the ADD and MUL with the VM's wrap-around are associative and commutative
+  bool isAccumulated = combination != JUMP;
+  auto accumulator = isAccumulated ? graph.NewTemporary() : "";
+  auto start = graph.NewLabel();
+  Code entry;
+  if (isAccumulated) {
+    entry.emplace_back(PUSH, std::vector<std::string>{combination == ADD ? "0" : "1"});
+    entry.emplace_back(INTEGER_STORE, std::vector<std::string>{accumulator});
+  }
+  entry.emplace_back(LABEL, std::vector<std::string>{start});
+  graph.InsertBefore(1, entry);
+
+  for (auto& call : calls) {
+    // The first argument is on top
+    Code jump;
+    for (auto& param : graph.integerParams)
+      jump.emplace_back(INTEGER_STORE, std::vector<std::string>{param});
+    if (call.combination != NoInstruction) {
+      jump.emplace_back(INTEGER_LOAD, std::vector<std::string>{accumulator});
+      jump.emplace_back(combination, std::vector<std::string>{});
+      jump.emplace_back(INTEGER_STORE, std::vector<std::string>{accumulator});
+      graph.Delete(call.combination);
+    }
+    jump.emplace_back(JUMP, std::vector<std::string>{start});
+    graph.InsertBefore(call.call, jump);
+    graph.Delete(call.call);
+    graph.Delete(call.ret);
+  }
+
+  if (isAccumulated) {
+    for (int64_t ret : returns) {
+      if (!graph.instructions[ret].isDeleted)
+        graph.InsertBefore(ret, {{INTEGER_LOAD, {accumulator}}, {combination, {}}});
+    }
+  }
+  graph.Rebuild();
+  return true;
+}
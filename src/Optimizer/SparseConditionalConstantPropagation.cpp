@@ -0,0 +1,271 @@
+#include "Optimizer/Passes.h"
+
+#include <deque>
+#include <map>
+#include <optional>
+
+namespace {
+
+// Undefined: no executable path has computed the value yet (optimistic), above every constant.
+// Overdefined: differs between paths or isn't known at compile time.
+struct LatticeValue {
+  enum Kind { UNDEFINED, CONSTANT, OVERDEFINED };
+
+  Kind kind = UNDEFINED;
+  int64_t value = 0;
+
+  static LatticeValue Constant(int64_t value) { return {CONSTANT, value}; }
+  static LatticeValue Overdefined() { return {OVERDEFINED, 0}; }
+
+  [[nodiscard]] bool IsConstant() const { return kind == CONSTANT; }
+
+  // Lowers this value to the meet with other, returns whether it changed
+  bool Meet(const LatticeValue& other) {
+    if (other.kind == UNDEFINED || kind == OVERDEFINED)
+      return false;
+    if (kind == UNDEFINED || other.kind == OVERDEFINED || other.value != value) {
+      *this = kind == UNDEFINED ? other : Overdefined();
+      return true;
+    }
+    return false;
+  }
+};
+
+// Values at a block entry: integer variables and the operand stack left by the predecessors (bottom first)
+struct State {
+  std::vector<LatticeValue> variables;
+  std::vector<LatticeValue> stack;
+};
+
+enum Outcome { UNDECIDED, TAKEN, NOT_TAKEN, BOTH };
+
+Outcome Decide(Operation jump, const LatticeValue& lhs, const LatticeValue& rhs) {
+  if (lhs.kind == LatticeValue::UNDEFINED || rhs.kind == LatticeValue::UNDEFINED)
+    return UNDECIDED;
+  if (!lhs.IsConstant() || !rhs.IsConstant())
+    return BOTH;
+
+  bool isTaken = false;
+  switch (jump) {
+    case JUMP_EQ: isTaken = lhs.value == rhs.value; break;
+    case JUMP_NE: isTaken = lhs.value != rhs.value; break;
+    case JUMP_LT: isTaken = lhs.value < rhs.value; break;
+    case JUMP_LE: isTaken = lhs.value <= rhs.value; break;
+    case JUMP_GT: isTaken = lhs.value > rhs.value; break;
+    case JUMP_GE: isTaken = lhs.value >= rhs.value; break;
+    default: break;
+  }
+  return isTaken ? TAKEN : NOT_TAKEN;
+}
+
+class Propagation {
+ public:
+  explicit Propagation(ControlFlowGraph& graph) : graph(graph) {
+    for (auto& instruction : graph.instructions) {
+      if (instruction.operation == INTEGER_LOAD || instruction.operation == INTEGER_STORE)
+        variables.emplace(instruction.operands[0], variables.size());
+    }
+    entries.resize(graph.blocks.size());
+    isQueued.resize(graph.blocks.size(), false);
+    results.resize(graph.instructions.size());
+    outcomes.resize(graph.instructions.size(), UNDECIDED);
+    comparisons.resize(graph.instructions.size(), NoInstruction);
+  }
+
+  void Solve() {
+    if (graph.blocks.empty())
+      return;
+
+    // Parameters and variables read before any store are unknown
+    State entry;
+    entry.variables.assign(variables.size(), LatticeValue::Overdefined());
+    Flow(0, entry);
+
+    while (!worklist.empty()) {
+      int64_t block = worklist.front();
+      worklist.pop_front();
+      isQueued[block] = false;
+      Interpret(block);
+    }
+  }
+
+  bool Rewrite() {
+    bool isChanged = false;
+    bool isControlFlowChanged = false;
+
+    for (size_t block = 0; block < graph.blocks.size(); ++block) {
+      for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+        auto& instruction = graph.instructions[it];
+        if (instruction.isDeleted)
+          continue;
+
+        if (!entries[block]) {
+          if (instruction.operation != FUN_BEGIN && instruction.operation != FUN_END) {
+            graph.Delete(it);
+            isControlFlowChanged = true;
+          }
+          continue;
+        }
+
+        if (instruction.operation == INTEGER_LOAD && results[it].IsConstant()) {
+          graph.ReplaceWithConstant(it, results[it].value);
+          isChanged = true;
+        } else if (outcomes[it] == TAKEN || outcomes[it] == NOT_TAKEN) {
+          if (outcomes[it] == TAKEN) {
+            instruction.operation = JUMP;
+            instruction.operands.resize(1);
+          } else
+            graph.Delete(it);
+          // Computing the operands may have side effects, then the comparison stays
+          if (comparisons[it] != NoInstruction)
+            graph.DeleteWithInputs(comparisons[it]);
+          isControlFlowChanged = true;
+        }
+      }
+    }
+
+    if (isControlFlowChanged)
+      graph.Rebuild();
+    return isChanged || isControlFlowChanged;
+  }
+
+ private:
+  ControlFlowGraph& graph;
+  std::map<std::string, size_t> variables;
+  std::vector<std::optional<State>> entries; // Empty while no executable edge reaches the block
+  std::deque<int64_t> worklist;
+  std::vector<bool> isQueued;
+
+  // Filled by the last interpretation of each block, which sees its final entry state
+  std::vector<LatticeValue> results;  // Value pushed by the instruction
+  std::vector<Outcome> outcomes;      // Conditional jumps
+  std::vector<int64_t> comparisons;   // CMP a conditional jump tests
+
+  // Meets the state into the successor's entry, the edge becomes executable
+  void Flow(int64_t block, const State& state) {
+    auto& entry = entries[block];
+    bool isChanged = false;
+    if (!entry) {
+      entry = state;
+      isChanged = true;
+    } else {
+      for (size_t variable = 0; variable < variables.size(); ++variable)
+        isChanged = entry->variables[variable].Meet(state.variables[variable]) || isChanged;
+
+      // Stack depths may differ after calls with unknown arity, values are matched from the top
+      auto& stack = entry->stack;
+      if (stack.size() > state.stack.size()) {
+        stack.erase(stack.begin(), stack.begin() + static_cast<int64_t>(stack.size() - state.stack.size()));
+        isChanged = true;
+      }
+      size_t offset = state.stack.size() - stack.size();
+      for (size_t value = 0; value < stack.size(); ++value)
+        isChanged = stack[value].Meet(state.stack[offset + value]) || isChanged;
+    }
+
+    if (isChanged && !isQueued[block]) {
+      isQueued[block] = true;
+      worklist.push_back(block);
+    }
+  }
+
+  void Interpret(int64_t block) {
+    State state = *entries[block];
+    auto& stack = state.stack;
+    auto pop = [&stack]() {
+      if (stack.empty())
+        return LatticeValue::Overdefined();
+      auto value = stack.back();
+      stack.pop_back();
+      return value;
+    };
+
+    LatticeValue lhs = LatticeValue::Overdefined();
+    LatticeValue rhs = LatticeValue::Overdefined();
+    int64_t comparison = NoInstruction;
+    int64_t last = NoInstruction;
+
+    for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+      auto& instruction = graph.instructions[it];
+      if (instruction.isDeleted)
+        continue;
+      last = it;
+
+      auto operation = instruction.operation;
+      if (operation == PUSH) {
+        results[it] = LatticeValue::Constant(graph.ConstantValue(it));
+      } else if (operation == INTEGER_LOAD) {
+        results[it] = state.variables[variables[instruction.operands[0]]];
+      } else if (operation == INTEGER_STORE) {
+        state.variables[variables[instruction.operands[0]]] = pop();
+        continue;
+      } else if (operation == ADD || operation == SUB || operation == MUL || operation == DIV || operation == MOD) {
+        auto right = pop();
+        auto left = pop();
+        int64_t value;
+        if (left.kind == LatticeValue::UNDEFINED || right.kind == LatticeValue::UNDEFINED)
+          results[it] = LatticeValue();
+        else if (left.IsConstant() && right.IsConstant()
+            && ControlFlowGraph::Evaluate(operation, left.value, right.value, value))
+          results[it] = LatticeValue::Constant(value);
+        else
+          results[it] = LatticeValue::Overdefined();
+      } else if (operation == CMP) {
+        lhs = pop();
+        rhs = pop();
+        comparison = it;
+        continue;
+      } else if (ControlFlowGraph::IsJump(operation)) {
+        if (operation != JUMP) {
+          outcomes[it] = Decide(operation, lhs, rhs);
+          comparisons[it] = comparison;
+        }
+        continue;
+      } else {
+        auto [pops, pushes] = graph.StackEffect(instruction);
+        if (pops == -1)
+          stack.clear();
+        for (int64_t pop = 0; pop < pops && !stack.empty(); ++pop)
+          stack.pop_back();
+        // The callee compares too
+        if (operation == FUN_CALL)
+          lhs = rhs = LatticeValue::Overdefined();
+        if (pushes == 0)
+          continue;
+        results[it] = LatticeValue::Overdefined();
+      }
+      stack.push_back(results[it]);
+    }
+
+    auto fallThrough = block + 1 < static_cast<int64_t>(graph.blocks.size()) ? block + 1 : NoInstruction;
+    if (last == NoInstruction) {
+      if (fallThrough != NoInstruction)
+        Flow(fallThrough, state);
+      return;
+    }
+
+    auto& instruction = graph.instructions[last];
+    auto operation = instruction.operation;
+    if (operation == RETURN || operation == FUN_END)
+      return;
+
+    bool isTargetExecutable = operation == JUMP || outcomes[last] == TAKEN || outcomes[last] == BOTH;
+    bool isFallThroughExecutable = !ControlFlowGraph::IsJump(operation)
+        || outcomes[last] == NOT_TAKEN || outcomes[last] == BOTH;
+    if (ControlFlowGraph::IsJump(operation) && isTargetExecutable) {
+      auto target = graph.labels.find(instruction.operands[0]);
+      if (target != graph.labels.end())
+        Flow(static_cast<int64_t>(graph.instructions[target->second].block), state);
+    }
+    if (isFallThroughExecutable && fallThrough != NoInstruction)
+      Flow(fallThrough, state);
+  }
+};
+
+}
+
+bool SparseConditionalConstantPropagation(ControlFlowGraph& graph) {
+  Propagation propagation(graph);
+  propagation.Solve();
+  return propagation.Rewrite();
+}
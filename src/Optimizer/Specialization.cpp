@@ -0,0 +1,173 @@
+#include "Optimizer/Optimizer.h"
+#include "Optimizer/ControlFlowGraph.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Command = std::pair<Operation, std::vector<std::string>>;
+
+// Callees larger than this aren't copied. Clones may add half the program size, but at least MinCloneBudget instructions
+constexpr size_t MaxSpecializedSize = 256;
+constexpr size_t MinCloneBudget = 256;
+constexpr int64_t HotCallsCount = 1000;
+
+struct CallSite {
+  std::string caller;
+  int64_t call = 0;
+  std::string callee;
+  std::vector<std::string> values; // Per param: the constant passed, empty if it isn't one
+  int64_t calls = 0;               // Of the callee, from the profile
+  size_t loopDepth = 0;
+};
+
+// "callee$value$_": one part per param, "_" for the ones left as params
+std::string CloneName(const CallSite& site) {
+  std::string name = site.callee;
+  for (auto& value : site.values)
+    name += '$' + (value.empty() ? std::string("_") : value);
+  return name;
+}
+
+// Params with a constant are dropped from the header and stored at the start of the body
+std::vector<Command> Clone(const std::vector<Command>& callee, const CallSite& site, const std::string& name) {
+  auto& header = callee.front().second;
+  std::vector<std::string> params = {name};
+  std::vector<Command> prologue;
+  for (size_t param = 0; param < site.values.size(); ++param) {
+    auto& type = header[2 * param + 1];
+    auto& variable = header[2 * param + 2];
+    if (site.values[param].empty()) {
+      params.push_back(type);
+      params.push_back(variable);
+      continue;
+    }
+    prologue.emplace_back(PUSH, std::vector<std::string>{site.values[param]});
+    prologue.emplace_back(INTEGER_STORE, std::vector<std::string>{variable});
+  }
+
+  std::vector<Command> clone = {{FUN_BEGIN, params}};
+  clone.insert(clone.end(), prologue.begin(), prologue.end());
+  clone.insert(clone.end(), callee.begin() + 1, callee.end());
+  return clone;
+}
+
+}
+
+bool Optimizer::specializeFunctions(std::vector<std::pair<Operation, std::vector<std::string>>>& bytecode,
+                                    const ProgramInfo& program) {
+  std::vector<std::string> order;
+  std::map<std::string, std::vector<Command>> functions;
+  std::string current;
+  for (auto& command : bytecode) {
+    if (command.first == FUN_BEGIN) {
+      current = command.second[0];
+      order.push_back(current);
+    }
+    functions[current].push_back(command);
+  }
+
+  // Calls passing a constant to an integer param, from loops or of functions the profile shows hot
+  std::map<std::string, ControlFlowGraph> graphs;
+  std::vector<CallSite> sites;
+  for (auto& caller : order) {
+    auto& graph = graphs.emplace(caller, ControlFlowGraph(functions[caller], program.arities, program.pureFunctions,
+                                                          program.terminatingFunctions))
+        .first->second;
+    std::vector<size_t> loopDepths(graph.blocks.size(), 0);
+    for (auto& loop : graph.FindLoops()) {
+      for (int64_t block : loop.blocks)
+        ++loopDepths[block];
+    }
+
+    for (size_t it = 0; it < graph.instructions.size(); ++it) {
+      auto& instruction = graph.instructions[it];
+      if (instruction.isDeleted || instruction.operation != FUN_CALL || instruction.operands[0] == caller)
+        continue;
+      auto callee = functions.find(instruction.operands[0]);
+      if (callee == functions.end() || callee->second.empty() || callee->second.front().first != FUN_BEGIN
+          || callee->second.size() > MaxSpecializedSize)
+        continue;
+      auto& header = callee->second.front().second;
+      if (header.size() != 2 * instruction.inputs.size() + 1)
+        continue;
+
+      CallSite site;
+      site.caller = caller;
+      site.call = static_cast<int64_t>(it);
+      site.callee = callee->first;
+      bool hasConstant = false;
+      for (size_t param = 0; param < instruction.inputs.size(); ++param) {
+        int64_t input = instruction.inputs[param];
+        bool isConstant = header[2 * param + 1] == "integer" && graph.IsConstant(input);
+        site.values.push_back(isConstant ? graph.instructions[input].operands[0] : "");
+        hasConstant = hasConstant || isConstant;
+      }
+      auto calls = program.callCounts.find(site.callee);
+      site.calls = calls == program.callCounts.end() ? 0 : calls->second;
+      site.loopDepth = loopDepths[instruction.block];
+      if (hasConstant && (site.loopDepth > 0 || site.calls >= HotCallsCount))
+        sites.push_back(std::move(site));
+    }
+  }
+  if (sites.empty())
+    return false;
+  std::stable_sort(sites.begin(), sites.end(), [](const CallSite& lhs, const CallSite& rhs) {
+    return lhs.calls != rhs.calls ? lhs.calls > rhs.calls : lhs.loopDepth > rhs.loopDepth;
+  });
+
+  size_t budget = std::max(MinCloneBudget, bytecode.size() / 2);
+  std::vector<std::string> clones;
+  std::map<std::string, std::string> callees; // Of the clones
+  for (auto& site : sites) {
+    auto name = CloneName(site);
+    if (!functions.count(name)) {
+      auto& callee = functions[site.callee];
+      if (callee.size() + 2 * site.values.size() > budget)
+        continue;
+      auto clone = Clone(callee, site, name);
+      budget -= clone.size();
+      functions[name] = std::move(clone);
+      clones.push_back(name);
+      callees[name] = site.callee;
+    }
+
+    auto& graph = graphs.at(site.caller);
+    auto& call = graph.instructions[site.call];
+    for (size_t param = 0; param < site.values.size(); ++param) {
+      if (!site.values[param].empty())
+        graph.Delete(call.inputs[param]);
+    }
+    call.operands[0] = name;
+  }
+  if (clones.empty())
+    return false;
+
+  for (auto& [caller, graph] : graphs)
+    functions[caller] = graph.Serialize();
+
+  // Constants in place of params let the passes fold the clones down
+  ProgramInfo specialized = program;
+  for (auto& name : clones) {
+    auto& clone = functions[name];
+    specialized.arities[name] = clone.front().second.size() / 2;
+    if (program.pureFunctions.count(callees[name]))
+      specialized.pureFunctions.insert(name);
+    if (program.terminatingFunctions.count(callees[name]))
+      specialized.terminatingFunctions.insert(name);
+  }
+  for (auto& [name, function] : functions)
+    specialized.bodies[name] = &function;
+  for (auto& name : clones)
+    optimize(functions[name], specialized);
+
+  std::vector<Command> result = std::move(functions[""]);
+  order.insert(order.end(), clones.begin(), clones.end());
+  for (auto& name : order)
+    result.insert(result.end(), functions[name].begin(), functions[name].end());
+  bytecode = std::move(result);
+  return true;
+}
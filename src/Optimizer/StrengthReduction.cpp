@@ -0,0 +1,279 @@
+#include "Optimizer/Passes.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace {
+
+using Code = std::vector<std::pair<Operation, std::vector<std::string>>>;
+
+// k if value is 2^k, -1 otherwise
+int64_t PowerOfTwo(int64_t value) {
+  if (value <= 0 || (value & (value - 1)) != 0)
+    return -1;
+  int64_t power = 0;
+  while ((int64_t(1) << power) != value)
+    ++power;
+  return power;
+}
+
+// Multiplier and shift for signed division by a positive divisor that is not a power of two
+// (Hacker's Delight, 10-1): x / divisor == high64(multiplier * x) (+ x if multiplier < 0) >> shift, + 1 if negative
+std::pair<int64_t, int64_t> DivisionMagic(int64_t divisor) {
+  const uint64_t two63 = uint64_t(1) << 63;
+  auto d = static_cast<uint64_t>(divisor);
+  uint64_t anc = two63 - 1 - two63 % d;
+  int64_t p = 63;
+  uint64_t q1 = two63 / anc;
+  uint64_t r1 = two63 - q1 * anc;
+  uint64_t q2 = two63 / d;
+  uint64_t r2 = two63 - q2 * d;
+  uint64_t delta;
+  do {
+    ++p;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      ++q1;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= d) {
+      ++q2;
+      r2 -= d;
+    }
+    delta = d - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  return {static_cast<int64_t>(q2 + 1), p - 64};
+}
+
+// Basic induction variable of a loop: every store in the loop is v = v + step or v = v - step,
+// the step being a constant or a variable the loop doesn't store
+struct Induction {
+  std::vector<int64_t> stores;
+  std::vector<bool> isDecrement; // Per store
+  std::vector<int64_t> steps;    // Per store: PUSH or INTEGER_LOAD of the step
+};
+
+class InductionVariables {
+ public:
+  InductionVariables(ControlFlowGraph& graph, const Loop& loop) : graph(graph), loop(loop) {}
+
+  bool Reduce() {
+    int64_t preheader = graph.PreheaderPosition(loop);
+    if (preheader == NoInstruction)
+      return false;
+    FindInductions();
+    FindOccurrences();
+
+    bool isReduced = false;
+    for (auto& [key, occurrences] : occurrences) {
+      auto& [variable, factor] = key;
+      auto& induction = inductions.at(variable);
+      // Each occurrence saves two instructions, each store costs four to keep the temporary up to date
+      if (occurrences.size() <= 2 * induction.stores.size())
+        continue;
+      Replace(induction, variable, factor, occurrences, preheader);
+      isReduced = true;
+    }
+    return isReduced;
+  }
+
+ private:
+  ControlFlowGraph& graph;
+  const Loop& loop;
+  std::map<std::string, Induction> inductions;
+  std::map<std::pair<std::string, int64_t>, std::vector<int64_t>> occurrences; // (variable, factor) -> MUL
+
+  // Live instruction right before the given one, NoInstruction at the block start
+  [[nodiscard]] int64_t Previous(int64_t id) const {
+    int64_t begin = graph.blocks[graph.instructions[id].block].begin;
+    for (int64_t it = id - 1; it >= begin; --it) {
+      if (!graph.instructions[it].isDeleted)
+        return it;
+    }
+    return NoInstruction;
+  }
+
+  [[nodiscard]] bool IsLoadOf(int64_t id, const std::string& variable) const {
+    return id != NoInstruction && graph.instructions[id].operation == INTEGER_LOAD
+        && graph.instructions[id].operands[0] == variable;
+  }
+
+  template<typename Visitor>
+  void ForEachInstruction(Visitor visitor) const {
+    for (int64_t block : loop.blocks) {
+      for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+        if (!graph.instructions[it].isDeleted)
+          visitor(it, graph.instructions[it]);
+      }
+    }
+  }
+
+  void FindInductions() {
+    std::set<std::string> invalid;
+    ForEachInstruction([&](int64_t it, const Instruction& instruction) {
+      if (instruction.operation == INTEGER_STORE)
+        inductions[instruction.operands[0]].stores.push_back(it);
+    });
+
+    for (auto& [variable, induction] : inductions) {
+      for (int64_t store : induction.stores) {
+        int64_t update = graph.instructions[store].inputs[0];
+        if (update == NoInstruction
+            || (graph.instructions[update].operation != ADD && graph.instructions[update].operation != SUB)) {
+          invalid.insert(variable);
+          break;
+        }
+        // SUB pops the step first, ADD may have it on either side
+        auto& inputs = graph.instructions[update].inputs;
+        bool isDecrement = graph.instructions[update].operation == SUB;
+        int64_t step = NoInstruction;
+        if (IsLoadOf(inputs[1], variable))
+          step = inputs[0];
+        else if (!isDecrement && IsLoadOf(inputs[0], variable))
+          step = inputs[1];
+        if (step == NoInstruction || !IsInvariantStep(step)) {
+          invalid.insert(variable);
+          break;
+        }
+        induction.isDecrement.push_back(isDecrement);
+        induction.steps.push_back(step);
+      }
+    }
+    for (auto& variable : invalid)
+      inductions.erase(variable);
+
+    // The preheader loads the variables, they must have a value on every path into the loop
+    ForEachInstruction([&](int64_t, const Instruction& instruction) {
+      if (instruction.operation == INTEGER_LOAD && instruction.isReachedByEntry && !IsParam(instruction.operands[0]))
+        inductions.erase(instruction.operands[0]);
+    });
+  }
+
+  [[nodiscard]] bool IsInvariantStep(int64_t step) const {
+    auto& instruction = graph.instructions[step];
+    if (instruction.operation == PUSH)
+      return true;
+    return instruction.operation == INTEGER_LOAD && !inductions.count(instruction.operands[0]);
+  }
+
+  [[nodiscard]] bool IsParam(const std::string& variable) const {
+    return std::find(graph.integerParams.begin(), graph.integerParams.end(), variable) != graph.integerParams.end();
+  }
+
+  // v * c with v and c pushed right before the multiplication, in any order
+  void FindOccurrences() {
+    ForEachInstruction([&](int64_t it, const Instruction& instruction) {
+      if (instruction.operation != MUL || instruction.inputs[0] == NoInstruction
+          || instruction.inputs[1] == NoInstruction)
+        return;
+      int64_t top = instruction.inputs[0];
+      int64_t bottom = instruction.inputs[1];
+      if (Previous(it) != top || Previous(top) != bottom)
+        return;
+      if (graph.IsConstant(bottom))
+        std::swap(top, bottom);
+      if (!graph.IsConstant(top) || graph.instructions[bottom].operation != INTEGER_LOAD)
+        return;
+
+      auto& variable = graph.instructions[bottom].operands[0];
+      int64_t factor = graph.ConstantValue(top);
+      if (inductions.count(variable) && factor != 0 && factor != 1 && factor != -1)
+        occurrences[{variable, factor}].push_back(it);
+    });
+  }
+
+  // temporary = v * factor before the loop, updated after every store of v, read instead of the product
+  void Replace(const Induction& induction, const std::string& variable, int64_t factor,
+               const std::vector<int64_t>& products, int64_t preheader) {
+    auto temporary = graph.NewTemporary();
+    graph.InsertBefore(preheader, {{INTEGER_LOAD, {variable}},
+                                   {PUSH, {std::to_string(factor)}},
+                                   {MUL, {}},
+                                   {INTEGER_STORE, {temporary}}});
+
+    // A variable step is scaled once in the preheader too
+    std::map<std::string, std::string> scaledSteps;
+    for (size_t it = 0; it < induction.stores.size(); ++it) {
+      auto& step = graph.instructions[induction.steps[it]];
+      std::pair<Operation, std::vector<std::string>> increment;
+      if (step.operation == PUSH) {
+        int64_t scaled;
+        ControlFlowGraph::Evaluate(MUL, graph.ConstantValue(induction.steps[it]), factor, scaled);
+        increment = {PUSH, {std::to_string(scaled)}};
+      } else {
+        auto& scaled = scaledSteps[step.operands[0]];
+        if (scaled.empty()) {
+          scaled = graph.NewTemporary();
+          graph.InsertBefore(preheader, {{INTEGER_LOAD, {step.operands[0]}},
+                                         {PUSH, {std::to_string(factor)}},
+                                         {MUL, {}},
+                                         {INTEGER_STORE, {scaled}}});
+        }
+        increment = {INTEGER_LOAD, {scaled}};
+      }
+      graph.InsertBefore(induction.stores[it] + 1, {{INTEGER_LOAD, {temporary}},
+                                                    increment,
+                                                    {induction.isDecrement[it] ? SUB : ADD, {}},
+                                                    {INTEGER_STORE, {temporary}}});
+    }
+
+    for (int64_t product : products) {
+      graph.Delete(graph.instructions[product].inputs[0]);
+      graph.Delete(graph.instructions[product].inputs[1]);
+      graph.Delete(product);
+      graph.InsertBefore(product, {{INTEGER_LOAD, {temporary}}});
+    }
+  }
+};
+
+}
+
+bool InductionVariableStrengthReduction(ControlFlowGraph& graph) {
+  for (auto& loop : graph.FindLoops()) {
+    if (InductionVariables(graph, loop).Reduce()) {
+      graph.Rebuild();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool StrengthReduction(ControlFlowGraph& graph) {
+  bool isReduced = false;
+  for (size_t it = 0; it < graph.instructions.size(); ++it) {
+    auto& instruction = graph.instructions[it];
+    if (instruction.isDeleted || (instruction.operation != MUL && instruction.operation != DIV))
+      continue;
+
+    // The divisor is on top, a factor may be on either side
+    int64_t constant = instruction.inputs[0];
+    if (instruction.operation == MUL && !graph.IsConstant(constant))
+      constant = instruction.inputs[1];
+    if (!graph.IsConstant(constant))
+      continue;
+
+    int64_t value = graph.ConstantValue(constant);
+    int64_t power = PowerOfTwo(value);
+    if (power == 0) {
+      graph.Delete(constant);
+      graph.Delete(static_cast<int64_t>(it));
+    } else if (power > 0) {
+      graph.Delete(constant);
+      instruction.operation = instruction.operation == MUL ? SHIFT_LEFT : SHIFT_RIGHT;
+      instruction.operands = {std::to_string(power)};
+    } else if (instruction.operation == DIV && value > 2) {
+      auto [multiplier, shift] = DivisionMagic(value);
+      graph.Delete(constant);
+      instruction.operation = MUL_HIGH_SHIFT;
+      instruction.operands = {std::to_string(multiplier), std::to_string(shift)};
+    } else {
+      continue;
+    }
+    isReduced = true;
+  }
+  return isReduced;
+}
@@ -0,0 +1,278 @@
+#include "Optimizer/Passes.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+
+namespace {
+
+constexpr int64_t NoNumber = -1;
+
+// Values computed by the expression: the variables and arrays it reads
+struct Expression {
+  bool isComputation = false; // Not just a constant or a variable load
+  std::vector<std::string> integers;
+  std::vector<std::string> arrays;
+};
+
+class ValueNumbering {
+ public:
+  explicit ValueNumbering(ControlFlowGraph& graph)
+      : graph(graph), numbers(graph.instructions.size(), NoNumber) {}
+
+  void Number() {
+    for (size_t it = 0; it < graph.instructions.size(); ++it) {
+      if (!graph.instructions[it].isDeleted)
+        numbers[it] = NumberOf(static_cast<int64_t>(it));
+    }
+    for (size_t number = 0; number < expressions.size(); ++number) {
+      auto& expression = expressions[number];
+      if (!expression.isComputation)
+        continue;
+      for (auto& variable : expression.integers)
+        integerReaders[variable].push_back(number);
+      for (auto& array : expression.arrays)
+        arrayReaders[array].push_back(number);
+      if (!expression.arrays.empty())
+        contentReaders.push_back(number);
+    }
+  }
+
+  // Available expressions: computed on every path to the point and not killed since
+  void FindAvailable() {
+    auto blocksCount = graph.blocks.size();
+    if (blocksCount == 0)
+      return;
+    in.assign(blocksCount, std::vector<bool>(expressions.size(), true));
+    out.assign(blocksCount, std::vector<bool>(expressions.size(), true));
+    in[0].assign(expressions.size(), false);
+
+    std::deque<int64_t> worklist;
+    std::vector<bool> isQueued(blocksCount, true);
+    for (size_t block = 0; block < blocksCount; ++block)
+      worklist.push_back(static_cast<int64_t>(block));
+    while (!worklist.empty()) {
+      int64_t block = worklist.front();
+      worklist.pop_front();
+      isQueued[block] = false;
+
+      if (block != 0 && !graph.blocks[block].predecessors.empty()) {
+        in[block].assign(expressions.size(), true);
+        for (int64_t predecessor : graph.blocks[block].predecessors) {
+          for (size_t number = 0; number < expressions.size(); ++number)
+            in[block][number] = in[block][number] && out[predecessor][number];
+        }
+      } else if (block != 0) {
+        in[block].assign(expressions.size(), false);
+      }
+
+      auto available = in[block];
+      Simulate(block, available, nullptr);
+      if (available == out[block])
+        continue;
+      out[block] = std::move(available);
+      for (int64_t successor : graph.blocks[block].successors) {
+        if (!isQueued[successor]) {
+          isQueued[successor] = true;
+          worklist.push_back(successor);
+        }
+      }
+    }
+  }
+
+  bool Rewrite() {
+    std::vector<bool> isRedundant(graph.instructions.size(), false);
+    for (size_t block = 0; block < graph.blocks.size(); ++block) {
+      auto available = in[block];
+      Simulate(static_cast<int64_t>(block), available, &isRedundant);
+    }
+
+    // The largest redundant expressions are replaced by a load of the temporary
+    std::vector<int64_t> replaced;
+    std::vector<bool> isNumberReplaced(expressions.size(), false);
+    for (size_t it = 0; it < graph.instructions.size(); ++it) {
+      auto user = graph.instructions[it].user;
+      if (!isRedundant[it] || (user != NoInstruction && isRedundant[user]) || !IsContiguous(static_cast<int64_t>(it)))
+        continue;
+      replaced.push_back(static_cast<int64_t>(it));
+      isNumberReplaced[numbers[it]] = true;
+    }
+    if (replaced.empty())
+      return false;
+
+    std::vector<std::string> temporaries(expressions.size());
+    for (size_t number = 0; number < expressions.size(); ++number) {
+      if (isNumberReplaced[number])
+        temporaries[number] = graph.NewTemporary();
+    }
+
+    // Every computation that isn't redundant keeps its value for the redundant ones, stack has no DUP
+    for (size_t it = 0; it < graph.instructions.size(); ++it) {
+      int64_t number = numbers[it];
+      if (number == NoNumber || !isNumberReplaced[number] || isRedundant[it] || graph.instructions[it].isDeleted)
+        continue;
+      graph.InsertBefore(static_cast<int64_t>(it) + 1, {{INTEGER_STORE, {temporaries[number]}},
+                                                        {INTEGER_LOAD, {temporaries[number]}}});
+    }
+
+    for (int64_t root : replaced) {
+      for (int64_t id : Tree(root))
+        graph.Delete(id);
+      graph.InsertBefore(root, {{INTEGER_LOAD, {temporaries[numbers[root]]}}});
+    }
+    graph.Rebuild();
+    return true;
+  }
+
+ private:
+  ControlFlowGraph& graph;
+  std::vector<int64_t> numbers; // Per instruction
+  std::map<std::string, int64_t> keys;
+  std::vector<Expression> expressions; // Per number
+  std::map<std::string, std::vector<size_t>> integerReaders;
+  std::map<std::string, std::vector<size_t>> arrayReaders;
+  std::vector<size_t> contentReaders;
+  std::vector<std::vector<bool>> in;
+  std::vector<std::vector<bool>> out;
+
+  // Same operation on the same numbers gives the same number. Variables are numbered by name,
+  // availability makes sure no store separates two loads with one number.
+  int64_t NumberOf(int64_t id) {
+    auto& instruction = graph.instructions[id];
+    auto operation = instruction.operation;
+    Expression expression;
+    std::string key;
+    switch (operation) {
+      case PUSH:
+        key = "#" + instruction.operands[0];
+        break;
+      case INTEGER_LOAD:
+        key = "$" + instruction.operands[0];
+        expression.integers.push_back(instruction.operands[0]);
+        break;
+      case ADD:
+      case SUB:
+      case MUL:
+      case DIV:
+      case MOD:
+      case LOAD_FROM_INDEX:
+      case LOAD_FROM_INDEX_UNCHECKED:
+        break;
+      case FUN_CALL:
+        if (!graph.IsPureCall(instruction))
+          return NoNumber;
+        break;
+      default:
+        return NoNumber;
+    }
+
+    if (key.empty()) {
+      std::vector<int64_t> inputs;
+      for (int64_t input : instruction.inputs) {
+        if (input == NoInstruction || numbers[input] == NoNumber)
+          return NoNumber;
+        inputs.push_back(numbers[input]);
+        auto& operand = expressions[numbers[input]];
+        expression.integers.insert(expression.integers.end(), operand.integers.begin(), operand.integers.end());
+        expression.arrays.insert(expression.arrays.end(), operand.arrays.begin(), operand.arrays.end());
+      }
+      if (operation == ADD || operation == MUL)
+        std::sort(inputs.begin(), inputs.end());
+
+      // Checked and unchecked reads give the same value
+      key = std::to_string(operation == LOAD_FROM_INDEX_UNCHECKED ? LOAD_FROM_INDEX : operation);
+      if (operation == LOAD_FROM_INDEX || operation == LOAD_FROM_INDEX_UNCHECKED) {
+        key += ' ' + instruction.operands[0];
+        expression.arrays.push_back(instruction.operands[0]);
+      } else if (operation == FUN_CALL) {
+        key += ' ' + instruction.operands[0];
+      }
+      for (int64_t input : inputs)
+        key += ' ' + std::to_string(input);
+      expression.isComputation = true;
+    }
+
+    auto number = keys.find(key);
+    if (number != keys.end())
+      return number->second;
+    keys.emplace(key, static_cast<int64_t>(expressions.size()));
+    expressions.push_back(std::move(expression));
+    return static_cast<int64_t>(expressions.size()) - 1;
+  }
+
+  // Runs the block over the available set, marking computations found available if asked
+  void Simulate(int64_t block, std::vector<bool>& available, std::vector<bool>* isRedundant) const {
+    auto kill = [&available](const std::vector<size_t>& readers) {
+      for (size_t number : readers)
+        available[number] = false;
+    };
+    static const std::vector<size_t> none;
+    auto readers = [](const std::map<std::string, std::vector<size_t>>& map,
+                      const std::string& name) -> const std::vector<size_t>& {
+      auto it = map.find(name);
+      return it == map.end() ? none : it->second;
+    };
+
+    for (int64_t it = graph.blocks[block].begin; it < graph.blocks[block].end; ++it) {
+      auto& instruction = graph.instructions[it];
+      if (instruction.isDeleted)
+        continue;
+
+      int64_t number = numbers[it];
+      if (number != NoNumber && expressions[number].isComputation) {
+        if (isRedundant && available[number])
+          (*isRedundant)[it] = true;
+        available[number] = true;
+        continue;
+      }
+
+      auto operation = instruction.operation;
+      if (operation == INTEGER_STORE) {
+        kill(readers(integerReaders, instruction.operands[0]));
+      } else if (operation == ARRAY_STORE) {
+        kill(readers(arrayReaders, instruction.operands[0]));
+      } else if (ControlFlowGraph::IsArrayWrite(operation)) {
+        // Any array variable may point to the written one
+        kill(contentReaders);
+      } else if (operation == FUN_CALL && !graph.IsPureCall(instruction)) {
+        kill(contentReaders);
+      }
+    }
+  }
+
+  [[nodiscard]] std::vector<int64_t> Tree(int64_t root) const {
+    std::vector<int64_t> tree;
+    std::vector<int64_t> worklist = {root};
+    while (!worklist.empty()) {
+      int64_t id = worklist.back();
+      worklist.pop_back();
+      tree.push_back(id);
+      worklist.insert(worklist.end(), graph.instructions[id].inputs.begin(), graph.instructions[id].inputs.end());
+    }
+    std::sort(tree.begin(), tree.end());
+    return tree;
+  }
+
+  // Nothing else is interleaved with the code computing the value
+  [[nodiscard]] bool IsContiguous(int64_t root) const {
+    auto tree = Tree(root);
+    size_t position = 0;
+    for (int64_t it = tree.front(); it <= root; ++it) {
+      if (graph.instructions[it].isDeleted)
+        continue;
+      if (tree[position] != it)
+        return false;
+      ++position;
+    }
+    return true;
+  }
+};
+
+}
+
+bool CommonSubexpressionElimination(ControlFlowGraph& graph) {
+  ValueNumbering numbering(graph);
+  numbering.Number();
+  numbering.FindAvailable();
+  return numbering.Rewrite();
+}
@@ -354,12 +354,13 @@ ExpressionsListAST* Parser::parseExpressionsList() {
 
 /// arrayInitialization : "new" "array" "[" expression "]";
 ArrayInitializationAST* Parser::parseArrayInitialization() {
+  size_t Line = Tok.getLine();
   consume(TokenKind::KW_new);
   consume(TokenKind::KW_array);
   consume(TokenKind::LSquare);
   auto* Expr = parseExpression();
   consume(TokenKind::RSquare);
-  return new ArrayInitializationAST(Expr);
+  return new ArrayInitializationAST(Expr, Line);
 }
 
 /// getByIndex : identifier "[" expression "]";
@@ -0,0 +1,216 @@
+#include <VirtualMachine/ArrayKernels.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAS_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+int64_t& Cell(const ArrayCells& cells, int64_t index) {
+  return *reinterpret_cast<int64_t*>(cells.first + index * cells.stride);
+}
+
+void FillScalar(const ArrayCells& cells, int64_t value, int64_t from = 0) {
+  for (int64_t it = from; it < cells.count; ++it)
+    Cell(cells, it) = value;
+}
+
+void IotaScalar(const ArrayCells& cells, int64_t first, int64_t step, int64_t from = 0) {
+  auto value = static_cast<uint64_t>(first) + static_cast<uint64_t>(step) * static_cast<uint64_t>(from);
+  for (int64_t it = from; it < cells.count; ++it) {
+    Cell(cells, it) = static_cast<int64_t>(value);
+    value += static_cast<uint64_t>(step);
+  }
+}
+
+void CopyScalar(const ArrayCells& destination, const ArrayCells& source, int64_t from = 0) {
+  for (int64_t it = from; it < destination.count; ++it)
+    Cell(destination, it) = Cell(source, it);
+}
+
+int64_t SumScalar(const ArrayCells& cells, int64_t initial, int64_t from = 0) {
+  auto sum = static_cast<uint64_t>(initial);
+  for (int64_t it = from; it < cells.count; ++it)
+    sum += static_cast<uint64_t>(Cell(cells, it));
+  return static_cast<int64_t>(sum);
+}
+
+int64_t MinScalar(const ArrayCells& cells, int64_t initial, int64_t from = 0) {
+  for (int64_t it = from; it < cells.count; ++it)
+    initial = std::min(initial, Cell(cells, it));
+  return initial;
+}
+
+int64_t MaxScalar(const ArrayCells& cells, int64_t initial, int64_t from = 0) {
+  for (int64_t it = from; it < cells.count; ++it)
+    initial = std::max(initial, Cell(cells, it));
+  return initial;
+}
+
+#ifdef HAS_AVX2_KERNELS
+
+#define AVX2 __attribute__((target("avx2")))
+
+// Heap cells are (flag, value) pairs: a 32-byte vector at a cell's flag holds two cells, values in lanes 1 and 3
+constexpr std::ptrdiff_t HeapCellSize = 2 * sizeof(int64_t);
+
+bool IsContiguous(const ArrayCells& cells) {
+  return cells.stride == sizeof(int64_t);
+}
+
+bool IsHeapLayout(const ArrayCells& cells) {
+  return cells.stride == HeapCellSize;
+}
+
+AVX2 __m256i* Vector(const ArrayCells& cells, int64_t index) {
+  auto* address = cells.first + index * cells.stride - (IsHeapLayout(cells) ? sizeof(int64_t) : 0);
+  return reinterpret_cast<__m256i*>(address);
+}
+
+AVX2 __m256i HeapValuesMask() {
+  return _mm256_setr_epi64x(0, -1, 0, -1);
+}
+
+// Four values of either layout, in any order
+AVX2 __m256i LoadFour(const ArrayCells& cells, int64_t index) {
+  if (IsContiguous(cells))
+    return _mm256_loadu_si256(Vector(cells, index));
+  __m256i low = _mm256_loadu_si256(Vector(cells, index));
+  __m256i high = _mm256_loadu_si256(Vector(cells, index + 2));
+  return _mm256_unpackhi_epi64(low, high);
+}
+
+AVX2 void FillAvx2(const ArrayCells& cells, int64_t value) {
+  __m256i values = _mm256_set1_epi64x(value);
+  int64_t it = 0;
+  if (IsContiguous(cells)) {
+    for (; it + 4 <= cells.count; it += 4)
+      _mm256_storeu_si256(Vector(cells, it), values);
+  } else if (IsHeapLayout(cells)) {
+    for (; it + 2 <= cells.count; it += 2)
+      _mm256_maskstore_epi64(reinterpret_cast<long long*>(Vector(cells, it)), HeapValuesMask(), values);
+  }
+  FillScalar(cells, value, it);
+}
+
+AVX2 void IotaAvx2(const ArrayCells& cells, int64_t first, int64_t step) {
+  auto value = [first, step](int64_t index) {
+    return static_cast<int64_t>(static_cast<uint64_t>(first) + static_cast<uint64_t>(step) * index);
+  };
+  int64_t it = 0;
+  if (IsContiguous(cells)) {
+    __m256i values = _mm256_setr_epi64x(value(0), value(1), value(2), value(3));
+    __m256i increment = _mm256_set1_epi64x(static_cast<int64_t>(static_cast<uint64_t>(step) * 4));
+    for (; it + 4 <= cells.count; it += 4) {
+      _mm256_storeu_si256(Vector(cells, it), values);
+      values = _mm256_add_epi64(values, increment);
+    }
+  } else if (IsHeapLayout(cells)) {
+    __m256i values = _mm256_setr_epi64x(0, value(0), 0, value(1));
+    __m256i increment = _mm256_set1_epi64x(static_cast<int64_t>(static_cast<uint64_t>(step) * 2));
+    for (; it + 2 <= cells.count; it += 2) {
+      _mm256_maskstore_epi64(reinterpret_cast<long long*>(Vector(cells, it)), HeapValuesMask(), values);
+      values = _mm256_add_epi64(values, increment);
+    }
+  }
+  IotaScalar(cells, first, step, it);
+}
+
+AVX2 void CopyAvx2(const ArrayCells& destination, const ArrayCells& source) {
+  int64_t it = 0;
+  if (IsContiguous(destination) && IsContiguous(source)) {
+    for (; it + 4 <= destination.count; it += 4)
+      _mm256_storeu_si256(Vector(destination, it), _mm256_loadu_si256(Vector(source, it)));
+  } else if (IsHeapLayout(destination) && IsHeapLayout(source)) {
+    for (; it + 2 <= destination.count; it += 2) {
+      _mm256_maskstore_epi64(reinterpret_cast<long long*>(Vector(destination, it)), HeapValuesMask(),
+                             _mm256_loadu_si256(Vector(source, it)));
+    }
+  }
+  CopyScalar(destination, source, it);
+}
+
+AVX2 __m256i AddFour(__m256i lhs, __m256i rhs) {
+  return _mm256_add_epi64(lhs, rhs);
+}
+
+AVX2 __m256i MinFour(__m256i lhs, __m256i rhs) {
+  return _mm256_blendv_epi8(lhs, rhs, _mm256_cmpgt_epi64(lhs, rhs));
+}
+
+AVX2 __m256i MaxFour(__m256i lhs, __m256i rhs) {
+  return _mm256_blendv_epi8(lhs, rhs, _mm256_cmpgt_epi64(rhs, lhs));
+}
+
+// Reduces four values at a time, then the lanes and the elements left
+template<__m256i (*Combine)(__m256i, __m256i), int64_t (*Scalar)(const ArrayCells&, int64_t, int64_t)>
+AVX2 int64_t Reduce(const ArrayCells& cells, int64_t initial) {
+  if (cells.count < 4 || (!IsContiguous(cells) && !IsHeapLayout(cells)))
+    return Scalar(cells, initial, 0);
+  __m256i accumulator = LoadFour(cells, 0);
+  int64_t it = 4;
+  for (; it + 4 <= cells.count; it += 4)
+    accumulator = Combine(accumulator, LoadFour(cells, it));
+  alignas(32) int64_t lanes[4];
+  _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), accumulator);
+  ArrayCells rest = {reinterpret_cast<char*>(lanes), sizeof(int64_t), 4};
+  return Scalar(cells, Scalar(rest, initial, 0), it);
+}
+
+#endif
+
+struct Kernels {
+  void (*fill)(const ArrayCells&, int64_t);
+  void (*iota)(const ArrayCells&, int64_t, int64_t);
+  void (*copy)(const ArrayCells&, const ArrayCells&);
+  int64_t (*sum)(const ArrayCells&, int64_t);
+  int64_t (*min)(const ArrayCells&, int64_t);
+  int64_t (*max)(const ArrayCells&, int64_t);
+};
+
+const Kernels& Selected() {
+  static const Kernels kernels = [] {
+#ifdef HAS_AVX2_KERNELS
+    if (__builtin_cpu_supports("avx2"))
+      return Kernels{FillAvx2, IotaAvx2, CopyAvx2, Reduce<AddFour, SumScalar>, Reduce<MinFour, MinScalar>,
+                     Reduce<MaxFour, MaxScalar>};
+#endif
+    return Kernels{
+        [](const ArrayCells& cells, int64_t value) { FillScalar(cells, value); },
+        [](const ArrayCells& cells, int64_t first, int64_t step) { IotaScalar(cells, first, step); },
+        [](const ArrayCells& destination, const ArrayCells& source) { CopyScalar(destination, source); },
+        [](const ArrayCells& cells, int64_t initial) { return SumScalar(cells, initial); },
+        [](const ArrayCells& cells, int64_t initial) { return MinScalar(cells, initial); },
+        [](const ArrayCells& cells, int64_t initial) { return MaxScalar(cells, initial); }};
+  }();
+  return kernels;
+}
+
+}
+
+void ArrayKernels::Fill(const ArrayCells& cells, int64_t value) {
+  Selected().fill(cells, value);
+}
+
+void ArrayKernels::Iota(const ArrayCells& cells, int64_t first, int64_t step) {
+  Selected().iota(cells, first, step);
+}
+
+void ArrayKernels::Copy(const ArrayCells& destination, const ArrayCells& source) {
+  Selected().copy(destination, source);
+}
+
+int64_t ArrayKernels::Sum(const ArrayCells& cells, int64_t initial) {
+  return Selected().sum(cells, initial);
+}
+
+int64_t ArrayKernels::Min(const ArrayCells& cells, int64_t initial) {
+  return Selected().min(cells, initial);
+}
+
+int64_t ArrayKernels::Max(const ArrayCells& cells, int64_t initial) {
+  return Selected().max(cells, initial);
+}
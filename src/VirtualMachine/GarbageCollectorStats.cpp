@@ -0,0 +1,130 @@
+#include <VirtualMachine/GarbageCollectorStats.h>
+
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+
+constexpr int64_t CellBytes = sizeof(int64_t);
+
+int64_t Percentile(std::vector<int64_t> values, double percentile) {
+  if (values.empty())
+    return 0;
+
+  std::sort(values.begin(), values.end());
+  auto index = static_cast<size_t>(percentile * static_cast<double>(values.size() - 1));
+  return values[index];
+}
+
+int64_t ElapsedNanoseconds(const GarbageCollectorStats& stats) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - stats.startTime).count();
+}
+
+}
+
+void GarbageCollectorStats::RecordPause(int64_t pauseNanoseconds) {
+  pauses.push_back(pauseNanoseconds);
+
+  size_t bucket = 0;
+  int64_t microseconds = pauseNanoseconds / 1000;
+  while (microseconds > 1 && bucket + 1 < PauseBuckets) {
+    microseconds /= 2;
+    bucket++;
+  }
+  pauseHistogram[bucket]++;
+}
+
+void GarbageCollectorStats::PrintSummary(std::ostream& out, const Heap& heap) const {
+  int64_t totalPause = 0;
+  for (int64_t pause : pauses)
+    totalPause += pause;
+  int64_t freedCells = 0;
+  double maxFragmentation = 0;
+  for (auto& collection : collections) {
+    freedCells += collection.freedCells;
+    maxFragmentation = std::max(maxFragmentation, collection.fragmentation);
+  }
+  double elapsedSeconds = static_cast<double>(ElapsedNanoseconds(*this)) / 1e9;
+
+  // The caller's stream, usually std::cerr, gets its formatting back afterwards
+  auto flags = out.flags();
+  auto precision = out.precision();
+  out << std::fixed << std::setprecision(3);
+  out << "GC statistics:\n";
+  out << "  collections:       " << collections.size() << " (" << compactions << " with compaction)\n";
+  out << "  pause total:       " << static_cast<double>(totalPause) / 1e6 << " ms\n";
+  out << "  pause p50/p99/max: " << static_cast<double>(Percentile(pauses, 0.5)) / 1e6 << " / "
+      << static_cast<double>(Percentile(pauses, 0.99)) / 1e6 << " / "
+      << static_cast<double>(Percentile(pauses, 1.0)) / 1e6 << " ms\n";
+  out << "  allocated:         " << heap.allocatedCells * CellBytes << " bytes in " << heap.allocations << " arrays\n";
+  out << "  frame-local:       " << heap.localAllocatedCells * CellBytes << " bytes in " << heap.localAllocations
+      << " arrays\n";
+  out << "  freed:             " << freedCells * CellBytes << " bytes\n";
+  if (referenceCountingReclaims > 0) {
+    out << "  freed by RC:       " << referenceCountingFreedCells * CellBytes << " bytes in "
+        << referenceCountingReclaims << " arrays\n";
+  }
+  out << "  live:              " << heap.usedCells * CellBytes << " bytes\n";
+  if (!collections.empty()) {
+    out << "  live after GC:     " << collections.back().liveCells * CellBytes << " bytes (last)\n";
+    out << "  fragmentation:     " << collections.back().fragmentation << " (last), " << maxFragmentation
+        << " (max)\n";
+  }
+  out << "  allocation rate:   "
+      << (elapsedSeconds > 0 ? static_cast<double>(heap.allocatedCells * CellBytes) / elapsedSeconds / 1e6 : 0.0)
+      << " MB/s\n";
+  out << "  pause histogram:\n";
+  for (size_t bucket = 0; bucket < PauseBuckets; ++bucket) {
+    if (pauseHistogram[bucket] == 0)
+      continue;
+    out << "    < " << (int64_t(2) << bucket) << " us: " << pauseHistogram[bucket] << '\n';
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+void GarbageCollectorStats::WriteJson(std::ostream& out, const Heap& heap) const {
+  int64_t totalPause = 0;
+  for (int64_t pause : pauses)
+    totalPause += pause;
+  int64_t freedCells = 0;
+  for (auto& collection : collections)
+    freedCells += collection.freedCells;
+  int64_t elapsed = ElapsedNanoseconds(*this);
+
+  out << "{\n";
+  out << "  \"elapsed_ns\": " << elapsed << ",\n";
+  out << "  \"collections\": " << collections.size() << ",\n";
+  out << "  \"compactions\": " << compactions << ",\n";
+  out << "  \"pause_total_ns\": " << totalPause << ",\n";
+  out << "  \"pause_p50_ns\": " << Percentile(pauses, 0.5) << ",\n";
+  out << "  \"pause_p99_ns\": " << Percentile(pauses, 0.99) << ",\n";
+  out << "  \"pause_max_ns\": " << Percentile(pauses, 1.0) << ",\n";
+  out << "  \"pause_histogram_us\": [";
+  for (size_t bucket = 0; bucket < PauseBuckets; ++bucket)
+    out << (bucket ? ", " : "") << "{\"lt\": " << (int64_t(2) << bucket) << ", \"count\": " << pauseHistogram[bucket] << "}";
+  out << "],\n";
+  out << "  \"allocations\": " << heap.allocations << ",\n";
+  out << "  \"allocated_bytes\": " << heap.allocatedCells * CellBytes << ",\n";
+  out << "  \"local_allocations\": " << heap.localAllocations << ",\n";
+  out << "  \"local_allocated_bytes\": " << heap.localAllocatedCells * CellBytes << ",\n";
+  out << "  \"freed_bytes\": " << freedCells * CellBytes << ",\n";
+  out << "  \"rc_reclaims\": " << referenceCountingReclaims << ",\n";
+  out << "  \"rc_freed_bytes\": " << referenceCountingFreedCells * CellBytes << ",\n";
+  out << "  \"live_bytes\": " << heap.usedCells * CellBytes << ",\n";
+  out << "  \"allocation_rate_bytes_per_sec\": "
+      << (elapsed > 0 ? static_cast<double>(heap.allocatedCells * CellBytes) * 1e9 / static_cast<double>(elapsed) : 0.0)
+      << ",\n";
+  out << "  \"history\": [";
+  for (size_t it = 0; it < collections.size(); ++it) {
+    auto& collection = collections[it];
+    out << (it ? ",\n    " : "\n    ") << "{\"pause_ns\": " << collection.pauseNanoseconds
+        << ", \"live_bytes\": " << collection.liveCells * CellBytes
+        << ", \"freed_bytes\": " << collection.freedCells * CellBytes
+        << ", \"fragmentation\": " << collection.fragmentation
+        << ", \"compacted\": " << (collection.isCompacted ? "true" : "false") << "}";
+  }
+  out << (collections.empty() ? "]\n" : "\n  ]\n");
+  out << "}\n";
+}
@@ -0,0 +1,82 @@
+#include <VirtualMachine/HeapProfiler.h>
+
+#include <algorithm>
+#include <iomanip>
+
+volatile std::sig_atomic_t HeapProfiler::isReportRequested = 0;
+
+void HeapProfiler::RecordAllocation(int64_t pointer, int64_t cells, const std::string& stack,
+                                    const std::string& function, int64_t line, bool isTracked) {
+  auto index = siteIndices.find(stack);
+  if (index == siteIndices.end()) {
+    index = siteIndices.emplace(stack, sites.size()).first;
+    sites.push_back({function, line});
+  }
+
+  auto& site = sites[index->second];
+  site.allocations++;
+  site.cells += cells;
+  // A swept array may be reused before the next collection, the new owner replaces it
+  if (isTracked)
+    trackedArrays[pointer] = {index->second, cells, false};
+}
+
+void HeapProfiler::ForgetArray(int64_t pointer) {
+  trackedArrays.erase(pointer);
+}
+
+void HeapProfiler::RetainLiveArrays(const std::function<bool(int64_t)>& isLive) {
+  for (auto it = trackedArrays.begin(); it != trackedArrays.end();) {
+    if (!isLive(it->first)) {
+      it = trackedArrays.erase(it);
+      continue;
+    }
+    if (!it->second.hasSurvived) {
+      sites[it->second.site].survivingCells += it->second.cells;
+      it->second.hasSurvived = true;
+    }
+    ++it;
+  }
+}
+
+void HeapProfiler::MoveArrays(const std::function<int64_t(int64_t)>& forward) {
+  std::unordered_map<int64_t, TrackedArray> movedArrays;
+  for (auto& [pointer, array] : trackedArrays)
+    movedArrays[forward(pointer)] = array;
+  trackedArrays = std::move(movedArrays);
+}
+
+void HeapProfiler::WriteFoldedStacks(std::ostream& out, bool isSurvivingOnly) const {
+  for (auto& [stack, index] : siteIndices) {
+    int64_t cells = isSurvivingOnly ? sites[index].survivingCells : sites[index].cells;
+    if (cells > 0)
+      out << stack << ' ' << cells << '\n';
+  }
+}
+
+void HeapProfiler::PrintSummary(std::ostream& out) const {
+  // Call stacks of the same site are merged
+  std::map<std::pair<std::string, int64_t>, Site> merged;
+  for (auto& site : sites) {
+    auto& total = merged[{site.function, site.line}];
+    total.function = site.function;
+    total.line = site.line;
+    total.allocations += site.allocations;
+    total.cells += site.cells;
+    total.survivingCells += site.survivingCells;
+  }
+
+  std::vector<Site> ordered;
+  for (auto& [location, site] : merged)
+    ordered.push_back(site);
+  std::sort(ordered.begin(), ordered.end(), [](const Site& lhs, const Site& rhs) {
+    return lhs.cells > rhs.cells;
+  });
+
+  out << "Heap profile (cells):\n";
+  out << std::setw(14) << "allocations" << std::setw(14) << "cells" << std::setw(14) << "surviving" << "  site\n";
+  for (auto& site : ordered) {
+    out << std::setw(14) << site.allocations << std::setw(14) << site.cells << std::setw(14) << site.survivingCells
+        << "  " << site.function << ':' << site.line << '\n';
+  }
+}
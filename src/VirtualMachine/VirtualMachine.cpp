@@ -4,8 +4,15 @@
 
 #include <VirtualMachine/VirtualMachine.h>
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <deque>
+#include <fstream>
+
 VirtualMachine::VirtualMachine(int64_t heapSize, const Bytecode& bytecode)
-  : heap(heapSize) {
+  : heap(heapSize, heapSize / 8), pureFunctions(Optimizer::findPureFunctions(bytecode)),
+    terminatingFunctions(Optimizer::findTerminatingFunctions(bytecode, pureFunctions)) {
   int64_t currentPos = 0;
   std::string lastFunctionName;
   for (auto& [op, operands] : bytecode ) {
@@ -44,11 +51,17 @@ VirtualMachine::VirtualMachine(int64_t heapSize, const Bytecode& bytecode)
 
   StackFrame stackFrame;
   stackFrame.functionContext = functionTable["main"];
+  stackFrame.localRegionMark = heap.localRegionTop;
   callStack.push_back(stackFrame);
 }
 
 void VirtualMachine::Execute() {
   while (!callStack.empty()) {
+    if (HeapProfiler::isReportRequested) {
+      HeapProfiler::isReportRequested = 0;
+      WriteHeapProfile();
+    }
+
     int64_t currentLine = callStack.back().currentPos++;
 
     auto& command = callStack.back().functionContext.bytecode[currentLine];
@@ -60,15 +73,27 @@ void VirtualMachine::Execute() {
       case (MUL): Mul(operands); break;
       case (DIV): Div(operands); break;
       case (MOD): Mod(operands); break;
+      case (SHIFT_LEFT): ShiftLeft(operands); break;
+      case (SHIFT_RIGHT): ShiftRight(operands); break;
+      case (MUL_HIGH_SHIFT): MulHighShift(operands); break;
       case (PUSH): Push(operands); break;
 
       case (INTEGER_LOAD): IntegerLoad(operands); break;
       case (ARRAY_LOAD): ArrayLoad(operands); break;
       case (LOAD_FROM_INDEX): LoadFromIndex(operands); break;
+      case (LOAD_FROM_INDEX_UNCHECKED): LoadFromIndexUnchecked(operands); break;
       case (INTEGER_STORE): IntegerStore(operands); break;
       case (ARRAY_STORE): ArrayStore(operands); break;
       case (STORE_IN_INDEX): StoreInIndex(operands); break;
+      case (STORE_IN_INDEX_UNCHECKED): StoreInIndexUnchecked(operands); break;
+      case (ARRAY_FILL): ArrayFill(operands); break;
+      case (ARRAY_IOTA): ArrayIota(operands); break;
+      case (ARRAY_COPY): ArrayCopy(operands); break;
+      case (ARRAY_SUM):
+      case (ARRAY_MIN):
+      case (ARRAY_MAX): ArrayReduce(operands, operation); break;
       case (NEW_ARRAY): NewArray(operands); break;
+      case (NEW_LOCAL_ARRAY): NewLocalArray(operands); break;
       case (PRINT): Print(operands); break;
 
       case (CMP): Cmp(operands); break;
@@ -84,7 +109,10 @@ void VirtualMachine::Execute() {
       case (FUN_CALL): CallFunction(operands); break;
       case (FUN_BEGIN): break;
       case (FUN_END): break;
-      case (LABEL): break;
+      case (LABEL):
+        if (profilingContext.isRecording && ExecutionProfile::IsRecordedKey(operands[0]))
+          ++RecordedFunction().loops[operands[0]].entries;
+        break;
     }
   }
 }
@@ -92,10 +120,38 @@ void VirtualMachine::Execute() {
 void VirtualMachine::EmergencyTermination() {
   std::cerr << "Termination of execution..." << std::endl;
 
-  while (!callStack.empty()) {
-    callStack.pop_back();
-    return;
+  callStack.clear();
+  returnCode = -1;
+}
+
+namespace {
+
+// Locals of inlined functions are renamed "$i<n>_function$name", once per level of inlining. The innermost
+// function, empty for names that aren't renamed, and the source name
+std::pair<std::string, std::string> SourceVariable(std::string name) {
+  std::string function;
+  while (name.rfind("$i", 0) == 0) {
+    size_t end = name.find('_', 2);
+    size_t separator = end == std::string::npos ? std::string::npos : name.find('$', end);
+    if (separator == std::string::npos || end == 2
+        || !std::all_of(name.begin() + 2, name.begin() + static_cast<std::ptrdiff_t>(end),
+                        [](char c) { return std::isdigit(static_cast<unsigned char>(c)); }))
+      break;
+    function = name.substr(end + 1, separator - end - 1);
+    name.erase(0, separator + 1);
   }
+  return {function, name};
+}
+
+}
+
+void VirtualMachine::IndexOutOfBounds(const std::string& arrayName, int64_t pointer, int64_t index) {
+  auto [function, name] = SourceVariable(arrayName);
+  if (function.empty())
+    function = ExecutionProfile::SourceFunction(callStack.back().functionContext.functionName);
+  std::cerr << "Index out of bounds in function: " << function << ": " << name << '[' << index << "], length "
+    << heap.ArrayLength(pointer) << std::endl;
+  EmergencyTermination();
 }
 
 void VirtualMachine::Add(std::vector<std::string>& operands) {
@@ -158,6 +214,39 @@ void VirtualMachine::Mod(std::vector<std::string>& operands) {
   operandStack.push(second % first);
 }
 
+void VirtualMachine::ShiftLeft(std::vector<std::string>& operands) {
+  auto& operandStack = callStack.back().operandStack;
+  auto value = static_cast<uint64_t>(operandStack.top());
+  operandStack.pop();
+  operandStack.push(static_cast<int64_t>(value << std::stoll(operands[0])));
+}
+
+void VirtualMachine::ShiftRight(std::vector<std::string>& operands) {
+  auto& operandStack = callStack.back().operandStack;
+  int64_t value = operandStack.top();
+  operandStack.pop();
+
+  // Negative values are biased by 2^k - 1 so the shift rounds toward zero like DIV
+  int64_t shift = std::stoll(operands[0]);
+  int64_t bias = (value >> 63) & ((int64_t(1) << shift) - 1);
+  operandStack.push((value + bias) >> shift);
+}
+
+void VirtualMachine::MulHighShift(std::vector<std::string>& operands) {
+  auto& operandStack = callStack.back().operandStack;
+  int64_t value = operandStack.top();
+  operandStack.pop();
+
+  int64_t multiplier = std::stoll(operands[0]);
+  auto quotient = static_cast<int64_t>((static_cast<__int128>(multiplier) * value) >> 64);
+  // A multiplier that didn't fit into 63 bits was stored minus 2^64
+  if (multiplier < 0)
+    quotient += value;
+  quotient >>= std::stoll(operands[1]);
+  quotient += static_cast<int64_t>(static_cast<uint64_t>(quotient) >> 63);
+  operandStack.push(quotient);
+}
+
 void VirtualMachine::Push(std::vector<std::string>& operands) {
   auto& currentStackFrame = callStack.back();
   auto& operandStack = currentStackFrame.operandStack;
@@ -210,6 +299,20 @@ void VirtualMachine::LoadFromIndex(std::vector<std::string>& operands) {
   int64_t index = operandStack.top();
   operandStack.pop();
   int64_t pointer = currentStackFrame.arrayVariables[arrayName];
+  if (!heap.IsInBounds(pointer, index)) {
+    IndexOutOfBounds(arrayName, pointer, index);
+    return;
+  }
+  operandStack.push(heap.GetValueByIndex(pointer + index));
+}
+
+void VirtualMachine::LoadFromIndexUnchecked(std::vector<std::string>& operands) {
+  auto& currentStackFrame = callStack.back();
+  auto& operandStack = currentStackFrame.operandStack;
+
+  int64_t index = operandStack.top();
+  operandStack.pop();
+  int64_t pointer = currentStackFrame.arrayVariables[operands[0]];
   operandStack.push(heap.GetValueByIndex(pointer + index));
 }
 
@@ -230,6 +333,12 @@ void VirtualMachine::ArrayStore(std::vector<std::string>& operands) {
   std::string variableName = operands[0];
   int64_t value = operandStack.top();
   operandStack.pop();
+  if (garbageCollector->IsReferenceCounting()) {
+    garbageCollector->AddReference(value);
+    auto variable = currentStackFrame.arrayVariables.find(variableName);
+    if (variable != currentStackFrame.arrayVariables.end())
+      garbageCollector->RemoveReference(variable->second);
+  }
   currentStackFrame.arrayVariables[variableName] = value;
 }
 
@@ -244,9 +353,126 @@ void VirtualMachine::StoreInIndex(std::vector<std::string>& operands) {
   int64_t value = operandStack.top();
   operandStack.pop();
 
+  if (!heap.IsInBounds(pointer, index)) {
+    IndexOutOfBounds(variableName, pointer, index);
+    return;
+  }
+  heap.SetValueByIndex(pointer + index, value);
+}
+
+void VirtualMachine::StoreInIndexUnchecked(std::vector<std::string>& operands) {
+  auto& currentStackFrame = callStack.back();
+  auto& operandStack = currentStackFrame.operandStack;
+
+  int64_t pointer = currentStackFrame.arrayVariables[operands[0]];
+  int64_t index = operandStack.top();
+  operandStack.pop();
+  int64_t value = operandStack.top();
+  operandStack.pop();
+
   heap.SetValueByIndex(pointer + index, value);
 }
 
+int64_t VirtualMachine::InBoundsEnd(int64_t pointer, int64_t begin, int64_t end) const {
+  if (begin >= end)
+    return end;
+  if (begin < 0)
+    return begin;
+  return std::clamp(heap.ArrayLength(pointer), begin, end);
+}
+
+void VirtualMachine::ArrayFill(std::vector<std::string>& operands) {
+  auto& currentStackFrame = callStack.back();
+  auto& operandStack = currentStackFrame.operandStack;
+
+  int64_t begin = operandStack.top();
+  operandStack.pop();
+  int64_t end = operandStack.top();
+  operandStack.pop();
+  int64_t value = operandStack.top();
+  operandStack.pop();
+
+  int64_t pointer = currentStackFrame.arrayVariables[operands[0]];
+  int64_t last = InBoundsEnd(pointer, begin, end);
+  if (last > begin)
+    ArrayKernels::Fill(heap.ElementCells(pointer, begin, last - begin), value);
+  if (last < end)
+    IndexOutOfBounds(operands[0], pointer, last);
+}
+
+void VirtualMachine::ArrayIota(std::vector<std::string>& operands) {
+  auto& currentStackFrame = callStack.back();
+  auto& operandStack = currentStackFrame.operandStack;
+
+  int64_t begin = operandStack.top();
+  operandStack.pop();
+  int64_t end = operandStack.top();
+  operandStack.pop();
+  int64_t step = operandStack.top();
+  operandStack.pop();
+  int64_t offset = operandStack.top();
+  operandStack.pop();
+
+  int64_t pointer = currentStackFrame.arrayVariables[operands[0]];
+  int64_t last = InBoundsEnd(pointer, begin, end);
+  if (last > begin) {
+    auto first = static_cast<int64_t>(static_cast<uint64_t>(offset) + static_cast<uint64_t>(step) * begin);
+    ArrayKernels::Iota(heap.ElementCells(pointer, begin, last - begin), first, step);
+  }
+  if (last < end)
+    IndexOutOfBounds(operands[0], pointer, last);
+}
+
+void VirtualMachine::ArrayCopy(std::vector<std::string>& operands) {
+  auto& currentStackFrame = callStack.back();
+  auto& operandStack = currentStackFrame.operandStack;
+
+  int64_t begin = operandStack.top();
+  operandStack.pop();
+  int64_t end = operandStack.top();
+  operandStack.pop();
+  int64_t source = operandStack.top();
+  operandStack.pop();
+
+  // The loop reads the source before it writes the destination
+  int64_t destination = currentStackFrame.arrayVariables[operands[0]];
+  int64_t sourceLast = InBoundsEnd(source, begin, end);
+  int64_t last = std::min(sourceLast, InBoundsEnd(destination, begin, end));
+  if (last > begin)
+    ArrayKernels::Copy(heap.ElementCells(destination, begin, last - begin), heap.ElementCells(source, begin, last - begin));
+  if (last < end)
+    IndexOutOfBounds(last == sourceLast ? operands[1] : operands[0], last == sourceLast ? source : destination, last);
+}
+
+void VirtualMachine::ArrayReduce(std::vector<std::string>& operands, Operation operation) {
+  auto& currentStackFrame = callStack.back();
+  auto& operandStack = currentStackFrame.operandStack;
+
+  int64_t begin = operandStack.top();
+  operandStack.pop();
+  int64_t end = operandStack.top();
+  operandStack.pop();
+  int64_t result = operandStack.top();
+  operandStack.pop();
+
+  int64_t pointer = currentStackFrame.arrayVariables[operands[0]];
+  int64_t last = InBoundsEnd(pointer, begin, end);
+  if (last < end) {
+    IndexOutOfBounds(operands[0], pointer, last);
+    return;
+  }
+  if (last > begin) {
+    auto cells = heap.ElementCells(pointer, begin, last - begin);
+    if (operation == ARRAY_SUM)
+      result = ArrayKernels::Sum(cells, result);
+    else if (operation == ARRAY_MIN)
+      result = ArrayKernels::Min(cells, result);
+    else
+      result = ArrayKernels::Max(cells, result);
+  }
+  operandStack.push(result);
+}
+
 void VirtualMachine::Cmp(std::vector<std::string>& operands) {
   auto& currentStackFrame = callStack.back();
   auto& operandStack = currentStackFrame.operandStack;
@@ -273,56 +499,60 @@ void VirtualMachine::Cmp(std::vector<std::string>& operands) {
 
 void VirtualMachine::Jump(std::vector<std::string>& operands) {
   auto& currentStackFrame = callStack.back();
-  const std::string& label = operands[0];
-  callStack.back().currentPos = currentStackFrame.functionContext.labels[label];
+  int64_t target = currentStackFrame.functionContext.labels[operands[0]];
+  if (profilingContext.isRecording && target < currentStackFrame.currentPos) {
+    // A back edge of the loop with its header at the label, or of an unrolled copy standing for several iterations
+    // that didn't exit. Jumps the optimizer added are neither
+    int64_t iterations = ExecutionProfile::UnrolledIterations(operands);
+    if (iterations == 0 && ExecutionProfile::IsRecordedKey(ExecutionProfile::BranchKey(operands)))
+      ++RecordedFunction().loops[operands[0]].iterations;
+    if (iterations > 0 && ExecutionProfile::IsRecordedKey(operands[1])) {
+      auto& loop = RecordedFunction().loops[operands[1]];
+      loop.iterations += iterations;
+      loop.entries += iterations;
+    }
+    if (iterations > 0 && ExecutionProfile::IsRecordedKey(operands[3])) {
+      auto& exit = RecordedFunction().branches[operands[3]];
+      bool isInverted = operands.size() > 4;
+      (isInverted ? exit.taken : exit.notTaken) += iterations;
+    }
+  }
+  currentStackFrame.currentPos = target;
 }
 
-void VirtualMachine::JumpEQ(std::vector<std::string>& operands) {
-  auto& currentStackFrame = callStack.back();
-  std::string label = operands[0];
+void VirtualMachine::ConditionalJump(std::vector<std::string>& operands, bool isTaken) {
+  const auto& key = ExecutionProfile::BranchKey(operands);
+  if (profilingContext.isRecording && ExecutionProfile::IsRecordedKey(key)) {
+    auto& branch = RecordedFunction().branches[key];
+    ++(isTaken != ExecutionProfile::IsInvertedBranch(operands) ? branch.taken : branch.notTaken);
+  }
+  // Loops of the source end with a JUMP, a conditional jump backwards is not a back edge
+  if (isTaken)
+    callStack.back().currentPos = callStack.back().functionContext.labels[operands[0]];
+}
 
-  if (compareResult.EQ)
-    callStack.back().currentPos = currentStackFrame.functionContext.labels[label];
+void VirtualMachine::JumpEQ(std::vector<std::string>& operands) {
+  ConditionalJump(operands, compareResult.EQ);
 }
 
 void VirtualMachine::JumpNE(std::vector<std::string>& operands) {
-  auto& currentStackFrame = callStack.back();
-  std::string label = operands[0];
-
-  if (compareResult.NE)
-    callStack.back().currentPos = currentStackFrame.functionContext.labels[label];
+  ConditionalJump(operands, compareResult.NE);
 }
 
 void VirtualMachine::JumpLT(std::vector<std::string>& operands) {
-  auto& currentStackFrame = callStack.back();
-  std::string label = operands[0];
-
-  if (compareResult.LT)
-    callStack.back().currentPos = currentStackFrame.functionContext.labels[label];
+  ConditionalJump(operands, compareResult.LT);
 }
 
 void VirtualMachine::JumpLE(std::vector<std::string>& operands) {
-  auto& currentStackFrame = callStack.back();
-  std::string label = operands[0];
-
-  if (compareResult.LE)
-    callStack.back().currentPos = currentStackFrame.functionContext.labels[label];
+  ConditionalJump(operands, compareResult.LE);
 }
 
 void VirtualMachine::JumpGT(std::vector<std::string>& operands) {
-  auto& currentStackFrame = callStack.back();
-  std::string label = operands[0];
-
-  if (compareResult.GT)
-    callStack.back().currentPos = currentStackFrame.functionContext.labels[label];
+  ConditionalJump(operands, compareResult.GT);
 }
 
 void VirtualMachine::JumpGE(std::vector<std::string>& operands) {
-  auto& currentStackFrame = callStack.back();
-  std::string label = operands[0];
-
-  if (compareResult.GE)
-    callStack.back().currentPos = currentStackFrame.functionContext.labels[label];
+  ConditionalJump(operands, compareResult.GE);
 }
 
 void VirtualMachine::NewArray(std::vector<std::string>& operands) {
@@ -332,20 +562,55 @@ void VirtualMachine::NewArray(std::vector<std::string>& operands) {
   int64_t arraySize = operandStack.top();
   operandStack.pop();
 
+  if (garbageCollector->IsReferenceCounting())
+    garbageCollector->ReclaimZeroCountArrays(false);
+
   int64_t arrayPtr = heap.AllocateMemory(arraySize);
+  if (arrayPtr == -1 && garbageCollector->IsReferenceCounting()) {
+    garbageCollector->ReclaimZeroCountArrays(true);
+    arrayPtr = heap.AllocateMemory(arraySize);
+  }
   if (arrayPtr == -1) {
     garbageCollector->CollectGarbage();
     arrayPtr = heap.AllocateMemory(arraySize);
+    if (arrayPtr == -1) {
+      // Enough free cells may still be scattered between live arrays
+      garbageCollector->CompactHeap();
+      arrayPtr = heap.AllocateMemory(arraySize);
+    }
 
     if (arrayPtr == -1) {
       std::cerr << "Can't allocate memory: don't have a enough space" << std::endl;
       EmergencyTermination();
-    } else {
-      operandStack.push(arrayPtr);
+      return;
     }
+  }
+
+  if (garbageCollector->IsReferenceCounting())
+    garbageCollector->TrackAllocation(arrayPtr);
+  if (heapProfiler && operands.size() == 2) {
+    heapProfiler->RecordAllocation(arrayPtr, arraySize + 1, CurrentCallStack() + ':' + operands[1], operands[0],
+                                   std::stoll(operands[1]), true);
+  }
+  operandStack.push(arrayPtr);
+}
+
+void VirtualMachine::NewLocalArray(std::vector<std::string>& operands) {
+  auto& currentStackFrame = callStack.back();
+  auto& operandStack = currentStackFrame.operandStack;
+
+  int64_t arrayPtr = heap.AllocateLocalMemory(operandStack.top());
+  if (arrayPtr == -1) {
+    // Local region is exhausted (e.g. deep recursion), fall back to the garbage collected heap
+    NewArray(operands);
     return;
   }
 
+  if (heapProfiler && operands.size() == 2) {
+    heapProfiler->RecordAllocation(arrayPtr, operandStack.top() + 1, CurrentCallStack() + ':' + operands[1],
+                                   operands[0], std::stoll(operands[1]), false);
+  }
+  operandStack.pop();
   operandStack.push(arrayPtr);
 }
 
@@ -364,8 +629,17 @@ void VirtualMachine::CallFunction(std::vector<std::string>& operands) {
   profilingContext.functionCalls[functionName]++;
   if (profilingContext.optimizedFunctions.find(functionName) == profilingContext.optimizedFunctions.end()
       && profilingContext.functionCalls[functionName] > profilingContext.callThreshold) {
+    ProgramInfo program;
+    program.pureFunctions = pureFunctions;
+    program.terminatingFunctions = terminatingFunctions;
+    program.callCounts = profilingContext.functionCalls;
+    program.profile = profilingContext.previous;
+    for (auto& [name, function] : functionTable) {
+      program.arities[name] = function.paramsDeclaration.size();
+      program.bodies[name] = &function.bytecode;
+    }
     auto& bytecode = functionTable[functionName].bytecode;
-    Optimizer::optimize(bytecode);
+    Optimizer::optimize(bytecode, program);
 
     std::cout << "Function optimized: " << '\n';
     for (int i = 0; i < bytecode.size(); ++i) {
@@ -387,23 +661,77 @@ void VirtualMachine::CallFunction(std::vector<std::string>& operands) {
   }
 
   auto& params = functionTable[functionName].paramsDeclaration;
+  if (pureFunctions.count(functionName) && CallMemoized(functionName, params.size(), newStackFrame))
+    return;
   for (auto& param : params) {
     if (param.second == INTEGER)
       newStackFrame.integerVariables[param.first] = currentStackFrame.operandStack.top();
-    else if (param.second == ARRAY)
+    else if (param.second == ARRAY) {
       newStackFrame.arrayVariables[param.first] = currentStackFrame.operandStack.top();
+      if (garbageCollector->IsReferenceCounting())
+        garbageCollector->AddReference(currentStackFrame.operandStack.top());
+    }
 
     currentStackFrame.operandStack.pop();
   }
 
   newStackFrame.functionContext = functionTable[functionName];
+  newStackFrame.localRegionMark = heap.localRegionTop;
   callStack.push_back(newStackFrame);
 }
 
+bool VirtualMachine::CallMemoized(const std::string& functionName, size_t arity, StackFrame& newStackFrame) {
+  auto& cache = profilingContext.memoCaches[functionName];
+  auto& operandStack = callStack.back().operandStack;
+  ++cache.calls;
+  if (!cache.isEnabled) {
+    if (cache.calls < MemoCache::RetryCalls)
+      return false;
+    cache.isEnabled = true;
+    cache.calls = 1;
+    cache.hits = 0;
+  }
+
+  // The first argument is on top
+  std::vector<int64_t> arguments(operandStack.c.rbegin(), operandStack.c.rbegin() + static_cast<int64_t>(arity));
+  auto result = cache.results.find(arguments);
+  bool isHit = result != cache.results.end();
+  if (isHit) {
+    ++cache.hits;
+    for (size_t argument = 0; argument < arity; ++argument)
+      operandStack.pop();
+    operandStack.push(result->second);
+  } else {
+    newStackFrame.memoCache = &cache;
+    newStackFrame.memoArguments = std::move(arguments);
+  }
+
+  // Less than one call in eight hitting doesn't pay for the lookups
+  if (cache.calls >= MemoCache::TrialCalls) {
+    cache.isEnabled = cache.hits * 8 >= cache.calls;
+    if (!cache.isEnabled)
+      cache.results.clear();
+    cache.calls = 0;
+    cache.hits = 0;
+  }
+  return isHit;
+}
+
 void VirtualMachine::Return(std::vector<std::string>& operands) {
   auto currentStackFrame = callStack.back();
   int64_t returnedValue = currentStackFrame.operandStack.top();
+  if (currentStackFrame.memoCache && currentStackFrame.memoCache->isEnabled) {
+    auto& results = currentStackFrame.memoCache->results;
+    if (results.size() >= MemoCache::Capacity)
+      results.clear();
+    results.emplace(std::move(currentStackFrame.memoArguments), returnedValue);
+  }
   callStack.pop_back();
+  heap.FreeLocalMemory(currentStackFrame.localRegionMark);
+  if (garbageCollector->IsReferenceCounting()) {
+    for (auto& array : currentStackFrame.arrayVariables)
+      garbageCollector->RemoveReference(array.second);
+  }
 
   if (currentStackFrame.functionContext.functionName == "main") {
     returnCode = returnedValue;
@@ -415,26 +743,438 @@ void VirtualMachine::Return(std::vector<std::string>& operands) {
   }
 }
 
+GarbageCollector::GarbageCollector(const std::shared_ptr<VirtualMachine>& vm, size_t threadsCount,
+                                   MemoryMode memoryMode)
+  : vm(vm), heap(&vm->heap), memoryMode(memoryMode), threadsCount(std::max<size_t>(threadsCount, 1)) {
+  for (size_t workerId = 1; workerId < this->threadsCount; ++workerId)
+    workers.emplace_back(&GarbageCollector::WorkerLoop, this, workerId);
+}
+
+GarbageCollector::~GarbageCollector() {
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    isStopping = true;
+  }
+  poolWakeUp.notify_all();
+  for (auto& worker : workers)
+    worker.join();
+}
+
+// Frames are joined the way flame graph tools expect, the caller appends the allocation line
+std::string VirtualMachine::CurrentCallStack() const {
+  std::string stack;
+  for (auto& stackFrame : callStack) {
+    if (!stack.empty())
+      stack += ';';
+    stack += stackFrame.functionContext.functionName;
+  }
+  return stack;
+}
+
+void VirtualMachine::WriteProfile(std::ostream& out) const {
+  auto profile = profilingContext.recorded;
+  for (auto& [name, calls] : profilingContext.functionCalls)
+    profile.functions[ExecutionProfile::SourceFunction(name)].calls += calls;
+  for (auto& [name, function] : profile.functions) {
+    for (auto& [label, loop] : function.loops)
+      loop.entries -= loop.iterations;
+  }
+  // Calls the optimizer inlined with the profile aren't counted, such functions keep its counts
+  for (auto& [name, function] : profilingContext.previous.functions) {
+    auto& recorded = profile.functions[name];
+    if (recorded.calls < function.calls)
+      recorded = function;
+  }
+  profile.Write(out);
+}
+
+void VirtualMachine::WriteHeapProfile() const {
+  if (!heapProfiler)
+    return;
+
+  heapProfiler->PrintSummary(std::cerr);
+  if (!heapProfileFile.empty()) {
+    std::ofstream allocated(heapProfileFile);
+    heapProfiler->WriteFoldedStacks(allocated, false);
+    std::ofstream surviving(heapProfileFile + ".surviving");
+    heapProfiler->WriteFoldedStacks(surviving, true);
+  }
+}
+
+void GarbageCollector::WorkerLoop(size_t workerId) {
+  int64_t seenGeneration = 0;
+  while (true) {
+    std::function<void(size_t)> task;
+    {
+      std::unique_lock<std::mutex> lock(poolMutex);
+      poolWakeUp.wait(lock, [&] { return isStopping || poolGeneration != seenGeneration; });
+      if (isStopping)
+        return;
+      seenGeneration = poolGeneration;
+      task = poolTask;
+    }
+
+    task(workerId);
+
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (--runningWorkers == 0)
+      poolDone.notify_one();
+  }
+}
+
+void GarbageCollector::RunInParallel(const std::function<void(size_t)>& task) {
+  if (workers.empty()) {
+    task(0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    poolTask = task;
+    runningWorkers = workers.size();
+    poolGeneration++;
+  }
+  poolWakeUp.notify_all();
+
+  task(0);
+
+  std::unique_lock<std::mutex> lock(poolMutex);
+  poolDone.wait(lock, [&] { return runningWorkers == 0; });
+}
+
+namespace {
+
+// Arrays are split into chunks of this many cells so idle workers can steal parts of a big array
+constexpr int64_t MarkChunkSize = 4096;
+
+struct MarkStack {
+  std::mutex mutex;
+  std::deque<std::pair<int64_t, int64_t>> ranges;
+};
+
+bool PopRange(MarkStack& markStack, bool fromBack, std::pair<int64_t, int64_t>& range) {
+  std::lock_guard<std::mutex> lock(markStack.mutex);
+  if (markStack.ranges.empty())
+    return false;
+
+  if (fromBack) {
+    range = markStack.ranges.back();
+    markStack.ranges.pop_back();
+  } else {
+    range = markStack.ranges.front();
+    markStack.ranges.pop_front();
+  }
+  return true;
+}
+
+}
+
+std::vector<int64_t> GarbageCollector::FindPinnedArrays(VirtualMachine& machine) {
+  std::vector<int64_t> pinned;
+  for (auto& stackFrame : machine.callStack) {
+    for (int64_t value : stackFrame.operandStack.c) {
+      if (machine.heap.LargeObjectSlot(value) != -1 || machine.heap.IsLiveHeapArray(value))
+        pinned.push_back(value);
+    }
+  }
+  std::sort(pinned.begin(), pinned.end());
+  pinned.erase(std::unique(pinned.begin(), pinned.end()), pinned.end());
+
+  return pinned;
+}
+
+// Returns live blocks in address order as (header index, length with the header)
+std::vector<std::pair<int64_t, int64_t>> GarbageCollector::Mark(VirtualMachine& machine,
+                                                                const std::vector<int64_t>& pinned,
+                                                                std::vector<uint8_t>& marked) {
+  auto& heap = machine.heap;
+  int64_t heapSize = heap.size;
+
+  std::vector<int64_t> roots;
+  for (int64_t arrayPtr : pinned) {
+    if (heap.LargeObjectSlot(arrayPtr) != -1)
+      heap.largeObjects[heap.LargeObjectSlot(arrayPtr)].isMarked = true;
+    else
+      roots.push_back(arrayPtr);
+  }
+  for (auto& stackFrame : machine.callStack) {
+    for (auto& array : stackFrame.arrayVariables) {
+      int64_t arrayPtr = array.second;
+      if (heap.LargeObjectSlot(arrayPtr) != -1) {
+        heap.largeObjects[heap.LargeObjectSlot(arrayPtr)].isMarked = true;
+        continue;
+      }
+      if (arrayPtr <= 0 || arrayPtr > heapSize || heap.IsLocalPointer(arrayPtr))
+        continue;
+      roots.push_back(arrayPtr);
+    }
+  }
+  // The same array may be referenced from several frames, mark it only once
+  std::sort(roots.begin(), roots.end());
+  roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+
+  // Roots are partitioned between workers, each array covers its header and elements
+  std::vector<MarkStack> markStacks(threadsCount);
+  std::vector<std::pair<int64_t, int64_t>> liveBlocks;
+  for (size_t it = 0; it < roots.size(); ++it) {
+    int64_t begin = roots[it] - 1;
+    int64_t end = std::min(begin + heap.heap[begin].value, heapSize);
+    liveBlocks.emplace_back(begin, end - begin);
+    for (int64_t chunk = begin; chunk < end; chunk += MarkChunkSize)
+      markStacks[it % threadsCount].ranges.emplace_back(chunk, std::min(chunk + MarkChunkSize, end));
+  }
+
+  RunInParallel([&](size_t workerId) {
+    std::pair<int64_t, int64_t> range;
+    while (true) {
+      bool hasWork = PopRange(markStacks[workerId], true, range);
+      for (size_t victim = 1; !hasWork && victim < threadsCount; ++victim)
+        hasWork = PopRange(markStacks[(workerId + victim) % threadsCount], false, range);
+      // Arrays hold no references, so no new work appears once every stack is drained
+      if (!hasWork)
+        return;
+
+      for (int64_t it = range.first; it < range.second; ++it)
+        marked[it] = 1;
+    }
+  });
+
+  return liveBlocks;
+}
+
+// Sweeps the rest of the heap at once instead of leaving it to the allocator
+void GarbageCollector::FinishSweep(VirtualMachine& machine) {
+  auto& heap = machine.heap;
+  int64_t sweepBegin = heap.sweepFrontier;
+  int64_t sweepSize = heap.size - sweepBegin;
+
+  // Every worker owns a contiguous chunk of the unswept part
+  int64_t chunkSize = (sweepSize + static_cast<int64_t>(threadsCount) - 1) / static_cast<int64_t>(threadsCount);
+  RunInParallel([&](size_t workerId) {
+    int64_t begin = sweepBegin + static_cast<int64_t>(workerId) * chunkSize;
+    int64_t end = std::min(begin + chunkSize, heap.size);
+    for (int64_t it = begin; it < end; ++it) {
+      if (!heap.marked[it])
+        heap.heap[it].isAllocated = false;
+      heap.marked[it] = 0;
+    }
+  });
+  heap.sweepFrontier = heap.size;
+}
+
+void GarbageCollector::Compact(VirtualMachine& machine, const std::vector<int64_t>& pinned) {
+  auto& heap = machine.heap;
+  auto blocks = machine.heap.AllocatedBlocks();
+
+  // Compute forwarding addresses. Arrays referenced from operand stacks can't be rewritten,
+  // so they stay in place and the following arrays slide up to their end.
+  std::vector<int64_t> forwarding(blocks.size());
+  int64_t free = 0;
+  for (size_t it = 0; it < blocks.size(); ++it) {
+    auto [begin, length] = blocks[it];
+    if (std::binary_search(pinned.begin(), pinned.end(), begin + 1)) {
+      forwarding[it] = begin;
+    } else {
+      forwarding[it] = free;
+    }
+    free = forwarding[it] + length;
+  }
+
+  // Rewrite roots
+  for (auto& stackFrame : machine.callStack) {
+    for (auto& array : stackFrame.arrayVariables) {
+      auto block = std::lower_bound(blocks.begin(), blocks.end(), std::make_pair(array.second - 1, int64_t(0)));
+      if (block != blocks.end() && block->first == array.second - 1)
+        array.second = forwarding[block - blocks.begin()] + 1;
+    }
+  }
+
+  if (machine.heapProfiler) {
+    machine.heapProfiler->MoveArrays([&](int64_t pointer) {
+      auto block = std::lower_bound(blocks.begin(), blocks.end(), std::make_pair(pointer - 1, int64_t(0)));
+      if (block == blocks.end() || block->first != pointer - 1)
+        return pointer;
+      return forwarding[block - blocks.begin()] + 1;
+    });
+  }
+
+  // Move arrays, blocks only ever move down so copying in address order is safe
+  for (size_t it = 0; it < blocks.size(); ++it) {
+    auto [begin, length] = blocks[it];
+    if (forwarding[it] != begin)
+      std::copy(heap.heap + begin, heap.heap + begin + length, heap.heap + forwarding[it]);
+  }
+
+  for (int64_t it = 0; it < heap.size; ++it)
+    heap.heap[it].isAllocated = false;
+  for (size_t it = 0; it < blocks.size(); ++it) {
+    for (int64_t cell = forwarding[it]; cell < forwarding[it] + blocks[it].second; ++cell) {
+      heap.heap[cell].isAllocated = true;
+      heap.heap[cell].isBlockStart = cell == forwarding[it];
+    }
+  }
+}
+
+// Only marks, sweeping is done by the allocator page by page
 void GarbageCollector::CollectGarbage() {
   if (auto sharedVM = vm.lock()) {
-    int64_t heapSize = sharedVM->heap.size;
-    auto marked = std::vector<bool>(heapSize, false);
+    auto pauseStart = std::chrono::steady_clock::now();
+    auto& heap = sharedVM->heap;
+    GarbageCollectorStats::Collection collection;
+    auto pinned = FindPinnedArrays(*sharedVM);
+    heap.ClearUnsweptMarks();
+    auto liveBlocks = Mark(*sharedVM, pinned, heap.marked);
+    heap.StartSweep();
+
+    if (sharedVM->heapProfiler) {
+      sharedVM->heapProfiler->RetainLiveArrays([&heap](int64_t pointer) {
+        int64_t slot = heap.LargeObjectSlot(pointer);
+        if (slot != -1)
+          return heap.largeObjects[slot].isMarked;
+        return pointer > 0 && pointer <= heap.size && heap.marked[pointer - 1] != 0;
+      });
+    }
+
+    // Large objects are few, so they are released right away
+    for (int64_t slot = 0; slot < static_cast<int64_t>(heap.largeObjects.size()); ++slot) {
+      auto& object = heap.largeObjects[slot];
+      if (object.memory && !object.isMarked)
+        heap.FreeLargeObject(slot);
+      object.isMarked = false;
+    }
+
+    int64_t liveCells = heap.largeObjectCells;
+    for (auto& block : liveBlocks)
+      liveCells += block.second;
+    collection.liveCells = liveCells;
+    collection.freedCells = std::max<int64_t>(heap.usedCells - liveCells, 0);
+    heap.usedCells = liveCells;
+
+    // Free space is everything between live blocks, so fragmentation is known without scanning the heap
+    int64_t freeCells = 0;
+    int64_t longestRun = 0;
+    int64_t previousEnd = 0;
+    for (auto& [begin, length] : liveBlocks) {
+      freeCells += begin - previousEnd;
+      longestRun = std::max(longestRun, begin - previousEnd);
+      previousEnd = begin + length;
+    }
+    freeCells += heap.size - previousEnd;
+    longestRun = std::max(longestRun, heap.size - previousEnd);
+
+    if (freeCells > 0)
+      collection.fragmentation = 1.0 - static_cast<double>(longestRun) / static_cast<double>(freeCells);
+
+    if (freeCells > 0 && collection.fragmentation >= compactionThreshold) {
+      FinishSweep(*sharedVM);
+      Compact(*sharedVM, pinned);
+      collection.isCompacted = true;
+      stats.compactions++;
+    }
+
+    if (IsReferenceCounting())
+      RebuildReferenceCounts(*sharedVM);
+
+    collection.pauseNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - pauseStart).count();
+    stats.collections.push_back(collection);
+    stats.RecordPause(collection.pauseNanoseconds);
+  }
+}
+
+void GarbageCollector::CompactHeap() {
+  if (auto sharedVM = vm.lock()) {
+    auto pauseStart = std::chrono::steady_clock::now();
+    FinishSweep(*sharedVM);
+    Compact(*sharedVM, FindPinnedArrays(*sharedVM));
+    if (IsReferenceCounting())
+      RebuildReferenceCounts(*sharedVM);
+
+    int64_t pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - pauseStart).count();
+    stats.compactions++;
+    stats.RecordPause(pause);
+    if (!stats.collections.empty() && !stats.collections.back().isCompacted) {
+      stats.collections.back().isCompacted = true;
+      stats.collections.back().pauseNanoseconds += pause;
+    }
+  }
+}
+
+void GarbageCollector::AddReference(int64_t pointer) {
+  if (heap->IsManagedPointer(pointer))
+    referenceCounts[pointer]++;
+}
+
+void GarbageCollector::RemoveReference(int64_t pointer) {
+  auto count = referenceCounts.find(pointer);
+  if (count == referenceCounts.end() || count->second == 0)
+    return;
 
+  if (--count->second == 0 && zeroCountTable.insert(pointer).second)
+    zeroCountCells += heap->BlockLength(pointer);
+}
+
+// A fresh array is referenced only from the operand stack until it is stored
+void GarbageCollector::TrackAllocation(int64_t pointer) {
+  if (!heap->IsManagedPointer(pointer))
+    return;
+
+  referenceCounts[pointer] = 0;
+  if (zeroCountTable.insert(pointer).second)
+    zeroCountCells += heap->BlockLength(pointer);
+}
+
+void GarbageCollector::ReclaimZeroCountArrays(bool isForced) {
+  if (!isForced && zeroCountTable.size() < ZeroCountTableLimit && zeroCountCells < heap->size / 16)
+    return;
+
+  if (auto sharedVM = vm.lock()) {
+    std::unordered_set<int64_t> stackReferences;
     for (auto& stackFrame : sharedVM->callStack) {
-      for (auto& array : stackFrame.arrayVariables) {
-        int64_t arrayPtr = array.second;
-        int64_t arraySize = sharedVM->heap.heap[array.second - 1].value;
-        marked[array.second - 1] = true;
-        for (int64_t it = arrayPtr; it < arrayPtr + arraySize; ++it) {
-          marked[it] = true;
-        }
+      for (int64_t value : stackFrame.operandStack.c) {
+        if (zeroCountTable.count(value))
+          stackReferences.insert(value);
       }
     }
 
-    for (int64_t it = 0; it < heapSize; ++it) {
-      if (!marked[it]) {
-        sharedVM->heap.heap[it].isAllocated = false;
+    zeroCountCells = 0;
+    for (auto it = zeroCountTable.begin(); it != zeroCountTable.end();) {
+      int64_t pointer = *it;
+      auto count = referenceCounts.find(pointer);
+      if (count != referenceCounts.end() && count->second > 0) {
+        it = zeroCountTable.erase(it);
+        continue;
       }
+      if (stackReferences.count(pointer)) {
+        zeroCountCells += heap->BlockLength(pointer);
+        ++it;
+        continue;
+      }
+
+      stats.referenceCountingReclaims++;
+      stats.referenceCountingFreedCells += heap->BlockLength(pointer);
+      heap->FreeMemory(pointer);
+      if (sharedVM->heapProfiler)
+        sharedVM->heapProfiler->ForgetArray(pointer);
+      referenceCounts.erase(pointer);
+      it = zeroCountTable.erase(it);
     }
   }
 }
+
+// Tracing collection frees and moves arrays behind the counts' back, so they are recounted from the roots
+void GarbageCollector::RebuildReferenceCounts(VirtualMachine& machine) {
+  referenceCounts.clear();
+  zeroCountTable.clear();
+  zeroCountCells = 0;
+
+  for (auto& stackFrame : machine.callStack) {
+    for (auto& array : stackFrame.arrayVariables)
+      AddReference(array.second);
+  }
+  for (int64_t pointer : FindPinnedArrays(machine)) {
+    if (referenceCounts[pointer] == 0)
+      TrackAllocation(pointer);
+  }
+}
@@ -4,16 +4,72 @@
 #include "VirtualMachine/VirtualMachine.h"
 #include "Optimizer/Optimizer.h"
 
+#include <csignal>
 #include <iostream>
 #include <fstream>
 
+static void RequestHeapProfile(int) {
+  HeapProfiler::isReportRequested = 1;
+}
+
 int main(int argc, const char** argv) {
-  if (argc != 2) {
-    std::cerr << "usage: anac file\n";
+  std::string SourceFile;
+  size_t GCThreads = 1;
+  bool GCStats = false;
+  std::string GCStatsFile;
+  MemoryMode Memory = TRACING;
+  bool HeapProfile = false;
+  std::string HeapProfileFile;
+  OptimizationLevel Level = NO_OPTIMIZATION;
+  std::string ProfileOutFile;
+  std::string ProfileInFile;
+  for (int i = 1; i < argc; ++i) {
+    std::string Arg = argv[i];
+    if (Arg.rfind("--gc-threads=", 0) == 0) {
+      std::string Value = Arg.substr(std::string("--gc-threads=").size());
+      bool IsNumber = !Value.empty() && Value.size() <= 9 && Value.find_first_not_of("0123456789") == std::string::npos;
+      GCThreads = IsNumber ? std::stoul(Value) : 0;
+      if (GCThreads == 0) {
+        SourceFile.clear();
+        break;
+      }
+    } else if (Arg == "--gc-stats") {
+      GCStats = true;
+    } else if (Arg == "--memory=rc") {
+      Memory = REFERENCE_COUNTING;
+    } else if (Arg == "--memory=gc") {
+      Memory = TRACING;
+    } else if (Arg == "--heap-profile") {
+      HeapProfile = true;
+    } else if (Arg.rfind("--heap-profile=", 0) == 0) {
+      HeapProfile = true;
+      HeapProfileFile = Arg.substr(std::string("--heap-profile=").size());
+    } else if (Arg == "-O0") {
+      Level = NO_OPTIMIZATION;
+    } else if (Arg == "-O1") {
+      Level = LOCAL_OPTIMIZATION;
+    } else if (Arg == "-O2") {
+      Level = FULL_OPTIMIZATION;
+    } else if (Arg.rfind("--profile-out=", 0) == 0) {
+      ProfileOutFile = Arg.substr(std::string("--profile-out=").size());
+    } else if (Arg.rfind("--profile-in=", 0) == 0) {
+      ProfileInFile = Arg.substr(std::string("--profile-in=").size());
+    } else if (Arg.rfind("--gc-stats-json=", 0) == 0) {
+      GCStatsFile = Arg.substr(std::string("--gc-stats-json=").size());
+    } else if (SourceFile.empty()) {
+      SourceFile = Arg;
+    } else {
+      SourceFile.clear();
+      break;
+    }
+  }
+
+  if (SourceFile.empty()) {
+    std::cerr << "usage: anac [-O0|-O1|-O2] [--memory=gc|rc] [--gc-threads=N] [--gc-stats] [--gc-stats-json=FILE]\n"
+                 "            [--heap-profile[=FILE]] [--profile-out=FILE] [--profile-in=FILE] file\n";
     return -1;
   }
 
-  std::string SourceFile = argv[1];
   std::cout << "Compiling... " << SourceFile << '\n';
 
   std::ifstream File(SourceFile);
@@ -40,6 +96,17 @@ int main(int argc, const char** argv) {
 
   BytecodeGenerator CodeGen;
   auto Bytecode = CodeGen.generate(*Tree);
+  Optimizer::escapeAnalysis(Bytecode);
+  Optimizer::boundsCheckElimination(Bytecode);
+  ExecutionProfile Profile;
+  if (!ProfileInFile.empty()) {
+    std::ifstream ProfileIn(ProfileInFile);
+    if (!ProfileIn || !Profile.Read(ProfileIn)) {
+      std::cerr << "Error reading profile " << ProfileInFile << std::endl;
+      return -1;
+    }
+  }
+  Optimizer::optimizeProgram(Bytecode, Level, Profile);
   for (int i = 0; i < Bytecode.size(); ++i) {
     std::cout << i << ' ' << ConvertOperationToString(Bytecode[i].first) << ' ';
     for (int j = 0; j < Bytecode[i].second.size(); ++j) {
@@ -49,9 +116,38 @@ int main(int argc, const char** argv) {
     std::cout << '\n';
   }
   auto vm = std::make_shared<VirtualMachine>(1000000, Bytecode);
-  vm->InitializeGarbageCollector();
+  vm->InitializeGarbageCollector(GCThreads, Memory);
+  vm->UseProfile(Profile);
+  if (!ProfileOutFile.empty())
+    vm->EnableProfileRecording();
+  if (HeapProfile) {
+    // SIGUSR1 dumps the profile of a running script
+    vm->EnableHeapProfiler(HeapProfileFile);
+    std::signal(SIGUSR1, RequestHeapProfile);
+  }
   vm->Execute();
   File.close();
 
+  if (GCStats)
+    vm->PrintGarbageCollectorStats(std::cerr);
+  if (!GCStatsFile.empty()) {
+    std::ofstream StatsFile(GCStatsFile);
+    if (!StatsFile) {
+      std::cerr << "Error writing GC statistics to " << GCStatsFile << std::endl;
+      return -1;
+    }
+    vm->WriteGarbageCollectorStats(StatsFile);
+  }
+  if (HeapProfile)
+    vm->WriteHeapProfile();
+  if (!ProfileOutFile.empty()) {
+    std::ofstream ProfileOut(ProfileOutFile);
+    if (!ProfileOut) {
+      std::cerr << "Error writing profile to " << ProfileOutFile << std::endl;
+      return -1;
+    }
+    vm->WriteProfile(ProfileOut);
+  }
+
   return vm->getReturnCode();
 }
\ No newline at end of file